@@ -0,0 +1,757 @@
+/* mfltbench.c -- FLT benchmark.			-*- coding: euc-jp; -*-
+   Copyright (C) 2026
+     National Institute of Advanced Industrial Science and Technology (AIST)
+     Registration Number H15PRO112
+
+   This file is part of the m17n library.
+
+   The m17n library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   The m17n library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the m17n library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   02111-1307, USA.  */
+
+/***en
+    @enpage m17n-fltbench measure the performance of FLTs
+
+    @section m17n-fltbench-synopsis SYNOPSIS
+
+    m17n-fltbench [ OPTION ... ] [ CORPUS ]
+
+    @section m17n-fltbench-description DESCRIPTION
+
+    Layout sample strings by every installed FLT (Font Layout Table)
+    with a synthetic font, and print the time spent for each FLT.  No
+    font file and no window system are used: the synthetic font gives
+    each character a glyph ID equal to its character code and
+    metrics computed from the glyph ID, so the results are the same
+    on any machine.
+
+    Each line of CORPUS is a sample string in UTF-8.  Each FLT lays
+    out all the runs of the characters it covers in the lines.  If
+    CORPUS is omitted, built-in sample strings of various scripts are
+    used.
+
+    For each FLT, the number of runs, characters, and output glyphs,
+    the time in microseconds, the number of glyphs laid out per
+    second, and the number of calls of the callback functions of the
+    font are printed.  The maximum resident set size is printed at
+    the end.
+
+    The time spent for each stage or regular expression matching of
+    an FLT is not measured by this program.  The environment variable
+    MDEBUG_FLT traces the stages, and a profiler can be used for the
+    details, as no display is needed.  With the option -a, the counts
+    of the objects allocated by the library are printed at the end.
+
+    The following OPTIONs are available.
+
+    <ul>
+
+    <li> -r COUNT
+
+    Layout the runs COUNT times (defaults to 1).
+
+    <li> -f FLT
+
+    Use only the FLT named FLT.
+
+    <li> -b
+
+    Layout all the runs of an FLT at once by mflt_run_batch ().
+
+    <li> -c SIZE
+
+    Set mflt_run_cache_size to SIZE.
+
+    <li> -t
+
+    Make the synthetic font pretend to have all the OpenType features.
+
+    <li> -o
+
+    Print the glyphs laid out from each run.
+
+    <li> -a
+
+    Print the counts of the objects allocated by the library to the
+    standard error at the end, as the environment variable MDEBUG_FINI
+    does.  As the library records each object, it makes the layout
+    slower.
+
+    <li> --version
+
+    Print version number.
+
+    <li> -h, --help
+
+    Print this message.
+
+    </ul>
+*/
+/***ja
+    @japage m17n-fltbench FLT ǽ¬ꤹ
+
+    @section m17n-fltbench-synopsis SYNOPSIS
+
+    m17n-fltbench [ OPTION ... ] [ CORPUS ]
+
+    @section m17n-fltbench-description 
+
+    󥹥ȡ뤵줿Ƥ FLT (Font Layout Table) ǡե
+    Ѥƥץʸ쥤Ȥ FLT פ֤ɽ
+    롣եȥե⥦ɥƥȤʤե
+    ϳʸʸɤ ID Ϳȥå򥰥
+    ID ׻Τǡ̤ϤɤΥޥǤƱǤ롣
+
+    CORPUS γƹԤ UTF-8 ΥץʸǤ롣 FLT ϡƹ
+    ʬСʸΥƥ쥤Ȥ롣CORPUS ά
+    ϡ͡ʸȤ߹ߤΥץʸѤ롣
+
+     FLT ˤĤơʸϥդοޥñ̤λ֡
+    ä˥쥤ȤդοեȤΥХåؿ
+    θƤӽФɽ롣Ǹ˺󥻥åȥɽ롣
+
+    FLT γƥơɽΥޥå󥰤פ֤ϤΥץ
+    Ǥ¬ꤷʤĶѿ MDEBUG_FLT ǥơȥ졼Ǥ
+    ǥץ쥤ɬפȤʤΤǾܺ٤ˤϥץեȤ롣ץ
+     -a ꤹȡǸ˥饤֥꤬Ƥ֥Ȥο
+    ɽ롣
+
+    ʲΥץѤǤ롣
+
+    <ul>
+
+    <li> -r COUNT
+
+     COUNT 쥤Ȥ롣(ǥեȤ 1)
+
+    <li> -f FLT
+
+    FLT Ȥ̾ FLT Ȥ
+
+    <li> -b
+
+    FLT ƤΥ mflt_run_batch () ǰ٤˥쥤Ȥ롣
+
+    <li> -c SIZE
+
+    mflt_run_cache_size  SIZE ˤ롣
+
+    <li> -t
+
+    եȤƤ OpenType εǽĤ褦˿񤦡
+
+    <li> -o
+
+    ƥ󤫤쥤Ȥ줿դɽ롣
+
+    <li> -a
+
+    Ķѿ MDEBUG_FINI ƱͤˡǸ˥饤֥꤬Ƥ֥
+    Ȥοɸ२顼Ϥɽ롣饤֥꤬ƥ֥Ȥ
+    ϿΤǡ쥤Ȥ٤ʤ롣
+
+    <li> --version
+
+    Сֹɽ롣
+
+    <li> -h, --help
+
+    Υåɽ롣
+
+    </ul>
+*/
+
+#ifndef FOR_DOXYGEN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <m17n-core.h>
+#include <m17n-flt.h>
+#include <m17n-misc.h>
+
+/* Print the usage of this program (the name is PROG), and exit with
+   EXIT_CODE.  */
+
+void
+help_exit (char *prog, int exit_code)
+{
+  char *p = prog;
+
+  while (*p)
+    if (*p++ == '/')
+      prog = p;
+
+  printf ("Usage: %s [ OPTION ... ] [ CORPUS ]\n", prog);
+  printf ("Layout sample strings by FLTs with a synthetic font and print timing statistics.\n");
+  printf ("  Each line of CORPUS is a sample string in UTF-8.\n");
+  printf ("  If CORPUS is omitted, built-in sample strings are used.\n");
+  printf ("The following OPTIONs are available.\n");
+  printf ("  %-13s %s", "-r COUNT",
+	  "Layout the runs COUNT times (defaults to 1).\n");
+  printf ("  %-13s %s", "-f FLT", "Use only the FLT named FLT.\n");
+  printf ("  %-13s %s", "-b", "Layout all the runs of an FLT at once.\n");
+  printf ("  %-13s %s", "-c SIZE", "Set mflt_run_cache_size to SIZE.\n");
+  printf ("  %-13s %s", "-t", "Pretend to have all OpenType features.\n");
+  printf ("  %-13s %s", "-o", "Print the glyphs laid out from each run.\n");
+  printf ("  %-13s %s", "-a", "Print the counts of allocated objects at the end.\n");
+  printf ("  %-13s %s", "--version", "Print version number.\n");
+  printf ("  %-13s %s", "-h, --help", "Print this message.\n");
+  printf ("The time of each stage or regular expression matching is not reported.\n");
+  printf ("  Use the environment variable MDEBUG_FLT or a profiler for it.\n");
+  exit (exit_code);
+}
+
+/* Format MSG by FMT and print the result to the stderr, and exit.  */
+
+#define FATAL_ERROR(fmt, arg)		\
+  do {					\
+    fprintf (stderr, fmt, arg);		\
+    exit (1);				\
+  } while (0)
+
+/* Sample strings used when CORPUS is omitted.  */
+
+char *default_corpus[] =
+  {
+    /* Devanagari */
+    "\xE0\xA4\xA8\xE0\xA4\xAE\xE0\xA4\xB8\xE0\xA5\x8D\xE0\xA4\xA4"
+    "\xE0\xA5\x87 \xE0\xA4\xB8\xE0\xA4\x82\xE0\xA4\xB8"
+    "\xE0\xA4\xBE\xE0\xA4\xB0 \xE0\xA4\x95\xE0\xA5\x8D"
+    "\xE0\xA4\xB7\xE0\xA4\xA4\xE0\xA5\x8D\xE0\xA4\xB0\xE0\xA4\xBF"
+    "\xE0\xA4\xAF \xE0\xA4\xB0\xE0\xA5\x8D\xE0\xA4\x95"
+    "\xE0\xA5\x8D\xE0\xA4\xB7",
+    /* Bengali */
+    "\xE0\xA6\x86\xE0\xA6\xAE\xE0\xA6\xBE\xE0\xA6\xB0 "
+    "\xE0\xA6\xB8\xE0\xA7\x8B\xE0\xA6\xA8\xE0\xA6\xBE\xE0\xA6\xB0"
+    " \xE0\xA6\xAC\xE0\xA6\xBE\xE0\xA6\x82\xE0\xA6\xB2"
+    "\xE0\xA6\xBE \xE0\xA6\x95\xE0\xA7\x8D\xE0\xA6\xB7"
+    "\xE0\xA7\x87\xE0\xA6\xA4\xE0\xA7\x8D\xE0\xA6\xB0",
+    /* Gurmukhi */
+    "\xE0\xA8\xAA\xE0\xA9\xB0\xE0\xA8\x9C\xE0\xA8\xBE\xE0\xA8\xAC"
+    "\xE0\xA9\x80 \xE0\xA8\xAD\xE0\xA8\xBE\xE0\xA8\xB8"
+    "\xE0\xA8\xBC\xE0\xA8\xBE \xE0\xA8\xB8\xE0\xA9\x8D"
+    "\xE0\xA8\xB0\xE0\xA9\x80",
+    /* Gujarati */
+    "\xE0\xAA\x97\xE0\xAB\x81\xE0\xAA\x9C\xE0\xAA\xB0\xE0\xAA\xBE"
+    "\xE0\xAA\xA4\xE0\xAB\x80 \xE0\xAA\xAD\xE0\xAA\xBE"
+    "\xE0\xAA\xB7\xE0\xAA\xBE \xE0\xAA\x95\xE0\xAB\x8D"
+    "\xE0\xAA\xB7\xE0\xAA\xA4\xE0\xAB\x8D\xE0\xAA\xB0\xE0\xAA\xBF"
+    "\xE0\xAA\xAF",
+    /* Oriya */
+    "\xE0\xAC\x93\xE0\xAC\xA1\xE0\xAC\xBC\xE0\xAC\xBF\xE0\xAC\x86"
+    " \xE0\xAC\xAD\xE0\xAC\xBE\xE0\xAC\xB7\xE0\xAC\xBE "
+    "\xE0\xAC\x95\xE0\xAD\x8D\xE0\xAC\xB7\xE0\xAD\x87\xE0\xAC\xA4"
+    "\xE0\xAD\x8D\xE0\xAC\xB0",
+    /* Tamil */
+    "\xE0\xAE\xA4\xE0\xAE\xAE\xE0\xAE\xBF\xE0\xAE\xB4\xE0\xAF\x8D"
+    " \xE0\xAE\xAE\xE0\xAF\x8A\xE0\xAE\xB4\xE0\xAE\xBF "
+    "\xE0\xAE\x95\xE0\xAF\x8D\xE0\xAE\xB7\xE0\xAF\x87\xE0\xAE\xA4"
+    "\xE0\xAF\x8D\xE0\xAE\xA4\xE0\xAE\xBF\xE0\xAE\xB0\xE0\xAE\xAE"
+    "\xE0\xAF\x8D",
+    /* Telugu */
+    "\xE0\xB0\xA4\xE0\xB1\x86\xE0\xB0\xB2\xE0\xB1\x81\xE0\xB0\x97"
+    "\xE0\xB1\x81 \xE0\xB0\xAD\xE0\xB0\xBE\xE0\xB0\xB7 "
+    "\xE0\xB0\x95\xE0\xB1\x8D\xE0\xB0\xB7\xE0\xB1\x87\xE0\xB0\xA4"
+    "\xE0\xB1\x8D\xE0\xB0\xB0\xE0\xB0\x82",
+    /* Kannada */
+    "\xE0\xB2\x95\xE0\xB2\xA8\xE0\xB3\x8D\xE0\xB2\xA8\xE0\xB2\xA1"
+    " \xE0\xB2\xAD\xE0\xB2\xBE\xE0\xB2\xB7\xE0\xB3\x86 "
+    "\xE0\xB2\x95\xE0\xB3\x8D\xE0\xB2\xB7\xE0\xB3\x87\xE0\xB2\xA4"
+    "\xE0\xB3\x8D\xE0\xB2\xB0",
+    /* Malayalam */
+    "\xE0\xB4\xAE\xE0\xB4\xB2\xE0\xB4\xAF\xE0\xB4\xBE\xE0\xB4\xB3"
+    "\xE0\xB4\x82 \xE0\xB4\xAD\xE0\xB4\xBE\xE0\xB4\xB7 "
+    "\xE0\xB4\x95\xE0\xB5\x8D\xE0\xB4\xB7\xE0\xB5\x87\xE0\xB4\xA4"
+    "\xE0\xB5\x8D\xE0\xB4\xB0\xE0\xB4\x82",
+    /* Sinhala */
+    "\xE0\xB7\x83\xE0\xB7\x92\xE0\xB6\x82\xE0\xB7\x84\xE0\xB6\xBD"
+    " \xE0\xB6\xB7\xE0\xB7\x8F\xE0\xB7\x82\xE0\xB7\x8F"
+    "\xE0\xB7\x80 \xE0\xB7\x81\xE0\xB7\x8A\xE2\x80\x8D"
+    "\xE0\xB6\xBB\xE0\xB7\x93",
+    /* Thai */
+    "\xE0\xB8\xA0\xE0\xB8\xB2\xE0\xB8\xA9\xE0\xB8\xB2\xE0\xB9\x84"
+    "\xE0\xB8\x97\xE0\xB8\xA2\xE0\xB8\x97\xE0\xB8\xB5\xE0\xB9\x88"
+    "\xE0\xB8\xAA\xE0\xB8\xA7\xE0\xB8\xA2\xE0\xB8\x87\xE0\xB8\xB2"
+    "\xE0\xB8\xA1 \xE0\xB8\x99\xE0\xB9\x89\xE0\xB8\xB3"
+    "\xE0\xB9\x83\xE0\xB8\x88",
+    /* Lao */
+    "\xE0\xBA\x9E\xE0\xBA\xB2\xE0\xBA\xAA\xE0\xBA\xB2\xE0\xBA\xA5"
+    "\xE0\xBA\xB2\xE0\xBA\xA7 \xE0\xBA\x99\xE0\xBB\x89"
+    "\xE0\xBA\xB3\xE0\xBB\x83\xE0\xBA\x88",
+    /* Tibetan */
+    "\xE0\xBD\x96\xE0\xBD\xBC\xE0\xBD\x91\xE0\xBC\x8B\xE0\xBD\xA1"
+    "\xE0\xBD\xB2\xE0\xBD\x82\xE0\xBC\x8B \xE0\xBD\x96"
+    "\xE0\xBD\xA6\xE0\xBE\x92\xE0\xBE\xB2\xE0\xBD\xB4\xE0\xBD\x96"
+    "\xE0\xBD\xA6\xE0\xBC\x8B",
+    /* Myanmar */
+    "\xE1\x80\x99\xE1\x80\xBC\xE1\x80\x94\xE1\x80\xBA\xE1\x80\x99"
+    "\xE1\x80\xAC\xE1\x80\x98\xE1\x80\xAC\xE1\x80\x9E\xE1\x80\xAC"
+    " \xE1\x80\x80\xE1\x80\xBC\xE1\x80\x80\xE1\x80\xBA",
+    /* Khmer */
+    "\xE1\x9E\x97\xE1\x9E\xB6\xE1\x9E\x9F\xE1\x9E\xB6\xE1\x9E\x81"
+    "\xE1\x9F\x92\xE1\x9E\x98\xE1\x9F\x82\xE1\x9E\x9A "
+    "\xE1\x9E\x9F\xE1\x9F\x92\xE1\x9E\x8F\xE1\x9F\x92\xE1\x9E\x9A"
+    "\xE1\x9E\xB8",
+    /* Hebrew */
+    "\xD7\xA9\xD6\xB8\xD7\x81\xD7\x9C\xD7\x95\xD6\xB9\xD7\x9D "
+    "\xD7\xA2\xD7\x95\xD6\xB9\xD7\x9C\xD6\xB8\xD7\x9D",
+    /* Arabic */
+    "\xD8\xA7\xD9\x84\xD8\xB3\xD9\x84\xD8\xA7\xD9\x85 \xD8\xB9"
+    "\xD9\x84\xD9\x8A\xD9\x83\xD9\x85 \xD9\x84\xD8\xA7 \xD8\xA5"
+    "\xD9\x84\xD9\x87",
+    /* Hangul */
+    "\xED\x95\x9C\xEA\xB5\xAD\xEC\x96\xB4 \xE1\x84\x92"
+    "\xE1\x86\x9E\xE1\x86\xAB\xE1\x84\x80\xE1\x86\x9E\xE1\x86\xAF",
+    /* Latin with combining marks */
+    "Tie\xCC\x82\xCC\x81ng Vie\xCC\xA3\xCC\x82t a\xCC\x88\xCC\x84",
+    NULL
+  };
+
+/* Array of characters of the sample strings.  Each string is
+   terminated by -1.  */
+int *chars;
+int nchars, chars_size;
+
+void
+add_char (int c)
+{
+  if (nchars == chars_size)
+    {
+      chars_size = chars_size ? chars_size * 2 : 1024;
+      chars = realloc (chars, sizeof (int) * chars_size);
+      if (! chars)
+	FATAL_ERROR ("%s\n", "Out of memory.");
+    }
+  chars[nchars++] = c;
+}
+
+void
+add_sample (char *str, int nbytes)
+{
+  MText *mt = mtext_from_data (str, nbytes, MTEXT_FORMAT_UTF_8);
+  int i, len;
+
+  if (! mt)
+    return;
+  len = mtext_len (mt);
+  for (i = 0; i < len; i++)
+    add_char (mtext_ref_char (mt, i));
+  if (len > 0)
+    add_char (-1);
+  m17n_object_unref (mt);
+}
+
+void
+read_corpus (FILE *fp)
+{
+  char *line = NULL;
+  int size = 0, len = 0;
+
+  while (1)
+    {
+      if (size - len < 2)
+	{
+	  size = size ? size * 2 : 4096;
+	  line = realloc (line, size);
+	  if (! line)
+	    FATAL_ERROR ("%s\n", "Out of memory.");
+	}
+      if (fgets (line + len, size - len, fp))
+	{
+	  len += strlen (line + len);
+	  if (line[len - 1] != '\n')
+	    continue;
+	}
+      else if (len == 0)
+	break;
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+	len--;
+      add_sample (line, len);
+      len = 0;
+    }
+  free (line);
+}
+
+/* The synthetic font.  */
+
+#define GLYPH(gstring, idx)	\
+  ((MFLTGlyph *) ((char *) (gstring)->glyphs + (gstring)->glyph_size * (idx)))
+
+/* Numbers of calls of the callback functions.  */
+int glyph_id_calls, metrics_calls, otf_calls;
+
+int
+get_glyph_id (MFLTFont *font, MFLTGlyphString *gstring, int from, int to)
+{
+  glyph_id_calls++;
+  for (; from < to; from++)
+    {
+      MFLTGlyph *g = GLYPH (gstring, from);
+
+      if (! g->encoded)
+	{
+	  g->code = g->c;
+	  g->encoded = 1;
+	}
+    }
+  return 0;
+}
+
+int
+get_metrics (MFLTFont *font, MFLTGlyphString *gstring, int from, int to)
+{
+  metrics_calls++;
+  for (; from < to; from++)
+    {
+      MFLTGlyph *g = GLYPH (gstring, from);
+
+      if (g->measured)
+	continue;
+      g->xadv = (6 + g->code % 7) << 6;
+      g->yadv = 0;
+      g->ascent = 12 << 6;
+      g->descent = 3 << 6;
+      g->lbearing = (g->code % 3) << 6;
+      g->rbearing = g->xadv - (1 << 6);
+      g->xoff = g->yoff = 0;
+      g->measured = 1;
+    }
+  return 0;
+}
+
+int
+check_otf (MFLTFont *font, MFLTOtfSpec *spec)
+{
+  return 1;
+}
+
+/* Copy the glyphs as if no glyph is substituted, and adjust the
+   position of some of them if GPOS features are requested.  */
+
+int
+drive_otf (MFLTFont *font, MFLTOtfSpec *spec,
+	   MFLTGlyphString *in, int from, int to,
+	   MFLTGlyphString *out, MFLTGlyphAdjustment *adjustment)
+{
+  int len = to - from;
+  int i;
+
+  otf_calls++;
+  if (out->allocated < out->used + len)
+    return -2;
+  font->get_glyph_id (font, in, from, to);
+  memcpy (GLYPH (out, out->used), GLYPH (in, from), in->glyph_size * len);
+  if (spec->features[1])
+    for (i = 0; i < len; i++)
+      if (GLYPH (out, out->used + i)->code % 5 == 0)
+	{
+	  adjustment[i].set = 1;
+	  adjustment[i].xoff = 1 << 6;
+	}
+  out->used += len;
+  return to;
+}
+
+/* Pretend that all the characters are handled by the feature.  */
+
+int
+iterate_otf_feature (MFLTFont *font, MFLTOtfSpec *spec,
+		     int from, int to, unsigned char *table)
+{
+  otf_calls++;
+  memset (table, 1, to + 1 - from);
+  return 0;
+}
+
+MSymbol
+font_id (MFLTFont *font)
+{
+  return msymbol ("m17n-fltbench");
+}
+
+long
+elapsed (struct timeval *tv0, struct timeval *tv1)
+{
+  return ((tv1->tv_sec - tv0->tv_sec) * 1000000
+	  + (tv1->tv_usec - tv0->tv_usec));
+}
+
+/* Runs of the characters covered by the current FLT.  */
+MFLTRun *runs;
+int *run_chars;
+int nruns, runs_size;
+
+MFLTGlyph *glyphs;
+MFLTGlyphString *gstrings;
+
+/* Collect the runs of the characters covered by FLT into RUNS, and
+   return the number of characters in them.  */
+
+int
+collect_runs (MFLT *flt, MFLTFont *font)
+{
+  MCharTable *coverage = mflt_coverage (flt);
+  int nglyphs = 0, total = 0;
+  int i, j;
+
+  nruns = 0;
+  for (i = 0; i < nchars; i = j)
+    {
+      for (; i < nchars && (chars[i] < 0
+			    || ! mchartable_lookup (coverage, chars[i])); i++);
+      for (j = i; j < nchars && chars[j] >= 0
+	     && mchartable_lookup (coverage, chars[j]); j++);
+      if (i == j)
+	continue;
+      if (nruns == runs_size)
+	{
+	  runs_size = runs_size ? runs_size * 2 : 256;
+	  runs = realloc (runs, sizeof (MFLTRun) * runs_size);
+	  run_chars = realloc (run_chars, sizeof (int) * runs_size);
+	  gstrings = realloc (gstrings, sizeof (MFLTGlyphString) * runs_size);
+	  if (! runs || ! run_chars || ! gstrings)
+	    FATAL_ERROR ("%s\n", "Out of memory.");
+	}
+      runs[nruns].from = 0;
+      runs[nruns].to = j - i;
+      runs[nruns].font = font;
+      runs[nruns].flt = flt;
+      run_chars[nruns] = i;
+      nruns++;
+      /* An FLT may produce more glyphs than characters.  */
+      nglyphs += (j - i) * 4 + 8;
+      total += j - i;
+    }
+
+  free (glyphs);
+  glyphs = malloc (sizeof (MFLTGlyph) * (nglyphs > 0 ? nglyphs : 1));
+  if (! glyphs)
+    FATAL_ERROR ("%s\n", "Out of memory.");
+  for (i = nglyphs = 0; i < nruns; i++)
+    {
+      gstrings[i].glyph_size = sizeof (MFLTGlyph);
+      gstrings[i].glyphs = glyphs + nglyphs;
+      gstrings[i].allocated = runs[i].to * 4 + 8;
+      gstrings[i].r2l = 0;
+      runs[i].gstring = gstrings + i;
+      nglyphs += gstrings[i].allocated;
+    }
+  return total;
+}
+
+/* Reset the glyphs of the runs to the characters.  */
+
+void
+reset_runs (void)
+{
+  int i, j;
+
+  for (i = 0; i < nruns; i++)
+    {
+      MFLTGlyphString *gstring = gstrings + i;
+
+      memset (gstring->glyphs, 0, sizeof (MFLTGlyph) * runs[i].to);
+      for (j = 0; j < runs[i].to; j++)
+	gstring->glyphs[j].c = chars[run_chars[i] + j];
+      gstring->used = runs[i].to;
+    }
+}
+
+void
+print_runs (MFLT *flt)
+{
+  int i, j;
+
+  for (i = 0; i < nruns; i++)
+    {
+      printf ("%s:", mflt_name (flt));
+      for (j = 0; j < runs[i].to; j++)
+	printf (" %04X", chars[run_chars[i] + j]);
+      printf (" ->");
+      if (runs[i].result < 0)
+	printf (" error %d", runs[i].result);
+      for (j = 0; j < runs[i].result; j++)
+	{
+	  MFLTGlyph *g = gstrings[i].glyphs + j;
+
+	  printf (" %04X", g->code);
+	  if (g->xoff || g->yoff)
+	    printf ("@%d,%d", g->xoff >> 6, g->yoff >> 6);
+	}
+      printf ("\n");
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  MSymbol flt_name = Mnil;
+  FILE *in = NULL;
+  int count = 1, batch = 0, output = 0, otf = 0;
+  MFLTFont font;
+  MPlist *plist, *pl;
+  struct timeval tv0, tv1;
+  struct rusage usage;
+  long total_time = 0, total_glyphs = 0;
+  int i, j;
+
+  /* MDEBUG_FINI must be set before the library is initialized.  */
+  for (i = 1; i < argc; i++)
+    if (! strcmp (argv[i], "-a"))
+      putenv ("MDEBUG_FINI=1");
+  M17N_INIT ();
+  if (merror_code != MERROR_NONE)
+    FATAL_ERROR ("%s\n", "Fail to initialize the m17n library.");
+
+  for (i = 1; i < argc; i++)
+    {
+      if (! strcmp (argv[i], "--help")
+	  || ! strcmp (argv[i], "-h")
+	  || ! strcmp (argv[i], "-?"))
+	help_exit (argv[0], 0);
+      else if (! strcmp (argv[i], "--version"))
+	{
+	  printf ("m17n-fltbench (m17n library) %s\n", M17NLIB_VERSION_NAME);
+	  printf ("Copyright (C) 2026 AIST, JAPAN\n");
+	  exit (0);
+	}
+      else if (! strcmp (argv[i], "-r") && i + 1 < argc)
+	{
+	  count = atoi (argv[++i]);
+	  if (count <= 0)
+	    help_exit (argv[0], 1);
+	}
+      else if (! strcmp (argv[i], "-f") && i + 1 < argc)
+	flt_name = msymbol (argv[++i]);
+      else if (! strcmp (argv[i], "-c") && i + 1 < argc)
+	mflt_run_cache_size = atoi (argv[++i]);
+      else if (! strcmp (argv[i], "-b"))
+	batch = 1;
+      else if (! strcmp (argv[i], "-t"))
+	otf = 1;
+      else if (! strcmp (argv[i], "-o"))
+	output = 1;
+      else if (! strcmp (argv[i], "-a"))
+	;
+      else if (argv[i][0] != '-' && ! in)
+	{
+	  in = fopen (argv[i], "r");
+	  if (! in)
+	    FATAL_ERROR ("Can't read the file %s\n", argv[i]);
+	}
+      else
+	help_exit (argv[0], 1);
+    }
+
+  if (in)
+    {
+      read_corpus (in);
+      fclose (in);
+    }
+  else
+    for (i = 0; default_corpus[i]; i++)
+      add_sample (default_corpus[i], strlen (default_corpus[i]));
+  if (nchars == 0)
+    FATAL_ERROR ("%s\n", "No sample string.");
+
+  memset (&font, 0, sizeof font);
+  font.x_ppem = font.y_ppem = 16;
+  font.get_glyph_id = get_glyph_id;
+  font.get_metrics = get_metrics;
+  if (otf)
+    {
+      font.check_otf = check_otf;
+      font.drive_otf = drive_otf;
+      mflt_iterate_otf_feature = iterate_otf_feature;
+    }
+  mflt_font_id = font_id;
+  /* The GUI library enables them too.  */
+  mflt_enable_new_feature = 1;
+
+  printf ("%-16s %6s %7s %8s %10s %11s %8s\n",
+	  "FLT", "runs", "chars", "glyphs", "usec", "glyphs/sec", "calls");
+  plist = mdatabase_list (msymbol ("font"), msymbol ("layouter"), Mnil, Mnil);
+  for (pl = plist; pl && mplist_key (pl) != Mnil; pl = mplist_next (pl))
+    {
+      MSymbol *tags = mdatabase_tag ((MDatabase *) mplist_value (pl));
+      MFLT *flt;
+      long time = 0, nglyphs = 0;
+      int calls, errors = 0, len;
+
+      if (flt_name != Mnil && tags[2] != flt_name)
+	continue;
+      flt = mflt_get (tags[2]);
+      if (! flt)
+	{
+	  printf ("%-16s can't be loaded\n", msymbol_name (tags[2]));
+	  continue;
+	}
+      len = collect_runs (flt, &font);
+      if (nruns == 0)
+	continue;
+      glyph_id_calls = metrics_calls = otf_calls = 0;
+      for (i = 0; i < count; i++)
+	{
+	  reset_runs ();
+	  gettimeofday (&tv0, NULL);
+	  if (batch)
+	    errors += mflt_run_batch (runs, nruns);
+	  else
+	    for (j = 0; j < nruns; j++)
+	      {
+		runs[j].result = mflt_run (runs[j].gstring, 0, runs[j].to,
+					   &font, flt);
+		if (runs[j].result < 0)
+		  errors++;
+	      }
+	  gettimeofday (&tv1, NULL);
+	  time += elapsed (&tv0, &tv1);
+	  for (j = 0; j < nruns; j++)
+	    if (runs[j].result > 0)
+	      nglyphs += runs[j].result;
+	}
+      calls = glyph_id_calls + metrics_calls + otf_calls;
+      printf ("%-16s %6d %7d %8ld %10ld %11.0f %8d",
+	      mflt_name (flt), nruns, len, nglyphs / count, time,
+	      time > 0 ? nglyphs * 1000000.0 / time : 0.0, calls / count);
+      if (errors)
+	printf (" (%d errors)", errors);
+      printf ("\n");
+      if (output)
+	print_runs (flt);
+      total_time += time;
+      total_glyphs += nglyphs;
+    }
+  if (plist)
+    m17n_object_unref (plist);
+
+  printf ("%-16s %6s %7s %8ld %10ld %11.0f\n", "total", "", "",
+	  total_glyphs / count, total_time,
+	  total_time > 0 ? total_glyphs * 1000000.0 / total_time : 0.0);
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    printf ("max resident set size: %ld KB\n", usage.ru_maxrss);
+
+  free (chars);
+  free (runs);
+  free (run_chars);
+  free (gstrings);
+  free (glyphs);
+  M17N_FINI ();
+  exit (0);
+}
+#endif /* not FOR_DOXYGEN */
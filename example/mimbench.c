@@ -0,0 +1,422 @@
+/* mimbench.c -- Input method benchmark.		-*- coding: euc-jp; -*-
+   Copyright (C) 2026
+     National Institute of Advanced Industrial Science and Technology (AIST)
+     Registration Number H15PRO112
+
+   This file is part of the m17n library.
+
+   The m17n library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public License
+   as published by the Free Software Foundation; either version 2.1 of
+   the License, or (at your option) any later version.
+
+   The m17n library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the m17n library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   02111-1307, USA.  */
+
+/***en
+    @enpage m17n-imbench measure the performance of an input method
+
+    @section m17n-imbench-synopsis SYNOPSIS
+
+    m17n-imbench [ OPTION ... ] LANGUAGE NAME [ KEYFILE ]
+
+    @section m17n-imbench-description DESCRIPTION
+
+    Replay key sequences through the input method specified by
+    LANGUAGE and NAME without any window system, and print statistics
+    of the time spent for each key.
+
+    Each line of KEYFILE is a sequence of key names (e.g. "a",
+    "space", "C-c") separated by spaces.  The input context is reset
+    at the end of each line.  Lines starting with ';' are ignored.  If
+    KEYFILE is omitted, the keys are read from standard input.
+
+    The following OPTIONs are available.
+
+    <ul>
+
+    <li> -r COUNT
+
+    Replay the whole key sequences COUNT times (defaults to 1).
+
+    <li> -b
+
+    Filter each line at once by minput_filter_batch ().  The time is
+    then measured for each line instead of each key.
+
+    <li> -o
+
+    Print the text produced from each line in UTF-8.
+
+    <li> --version
+
+    Print version number.
+
+    <li> -h, --help
+
+    Print this message.
+
+    </ul>
+*/
+/***ja
+    @japage m17n-imbench ϥ᥽åɤǽ¬ꤹ
+
+    @section m17n-imbench-synopsis SYNOPSIS
+
+    m17n-imbench [ OPTION ... ] LANGUAGE NAME [ KEYFILE ]
+
+    @section m17n-imbench-description 
+
+    LANGUAGE  NAME ǻꤵϥ᥽åɤˡɥƥ
+    ǥϤƥνפ֤פɽ롣
+
+    KEYFILE γƹԤϡǶڤ줿̾ (㤨 "a", "space",
+    "C-c") Ǥ롣ϥƥȤϳƹԤνǥꥻåȤ롣
+    ';' ǻϤޤԤ̵뤵롣KEYFILE ά줿ϡɸ
+    Ϥɤࡣ
+
+    ʲΥץѤǤ롣
+
+    <ul>
+
+    <li> -r COUNT
+
+    Τ COUNT 󷫤֤(ǥեȤ 1)
+
+    <li> -b
+
+    ƹԤ minput_filter_batch () ǰ٤˥ե륿롣ξ硢
+    ֤ϥǤϤʤ¬ꤵ롣
+
+    <li> -o
+
+    ƹԤ줿ƥȤ UTF-8 ɽ롣
+
+    <li> --version
+
+    Сֹɽ롣
+
+    <li> -h, --help
+
+    Υåɽ롣
+
+    </ul>
+*/
+
+#ifndef FOR_DOXYGEN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <m17n.h>
+#include <m17n-misc.h>
+
+/* Print the usage of this program (the name is PROG), and exit with
+   EXIT_CODE.  */
+
+void
+help_exit (char *prog, int exit_code)
+{
+  char *p = prog;
+
+  while (*p)
+    if (*p++ == '/')
+      prog = p;
+
+  printf ("Usage: %s [ OPTION ... ] LANGUAGE NAME [ KEYFILE ]\n", prog);
+  printf ("Replay key sequences through an input method and print timing statistics.\n");
+  printf ("  Each line of KEYFILE is a sequence of key names separated by spaces.\n");
+  printf ("  If KEYFILE is omitted, the keys are read from standard input.\n");
+  printf ("The following OPTIONs are available.\n");
+  printf ("  %-13s %s", "-r COUNT",
+	  "Replay the whole key sequences COUNT times (defaults to 1).\n");
+  printf ("  %-13s %s", "-b", "Filter each line at once.\n");
+  printf ("  %-13s %s", "-o", "Print the text produced from each line.\n");
+  printf ("  %-13s %s", "--version", "Print version number.\n");
+  printf ("  %-13s %s", "-h, --help", "Print this message.\n");
+  exit (exit_code);
+}
+
+/* Format MSG by FMT and print the result to the stderr, and exit.  */
+
+#define FATAL_ERROR(fmt, arg)		\
+  do {					\
+    fprintf (stderr, fmt, arg);		\
+    exit (1);				\
+  } while (0)
+
+/* Array of key sequences.  Each sequence is terminated by NULL
+   (not by Mnil, which is the symbol of the key named "nil").  */
+MSymbol *keys;
+int nkeys, keys_size;
+
+void
+add_key (MSymbol key)
+{
+  if (nkeys == keys_size)
+    {
+      keys_size = keys_size ? keys_size * 2 : 1024;
+      keys = realloc (keys, sizeof (MSymbol) * keys_size);
+      if (! keys)
+	FATAL_ERROR ("%s\n", "Out of memory.");
+    }
+  keys[nkeys++] = key;
+}
+
+/* Read a line from FP into *LINE, which is enlarged (and *SIZE is
+   updated) as necessary.  Return 0 on success, -1 at the end of
+   file.  */
+
+int
+read_line (FILE *fp, char **line, int *size)
+{
+  int len = 0;
+
+  while (1)
+    {
+      if (*size - len < 2)
+	{
+	  *size = *size ? *size * 2 : 4096;
+	  *line = realloc (*line, *size);
+	  if (! *line)
+	    FATAL_ERROR ("%s\n", "Out of memory.");
+	}
+      if (! fgets (*line + len, *size - len, fp))
+	return (len > 0 ? 0 : -1);
+      len += strlen (*line + len);
+      if ((*line)[len - 1] == '\n')
+	return 0;
+    }
+}
+
+void
+read_keys (FILE *fp)
+{
+  char *line = NULL;
+  int size = 0;
+
+  while (read_line (fp, &line, &size) == 0)
+    {
+      char *p = line;
+      int n = nkeys;
+
+      while (*p == ' ' || *p == '\t')
+	p++;
+      if (*p == ';')
+	continue;
+      for (p = strtok (p, " \t\r\n"); p; p = strtok (NULL, " \t\r\n"))
+	add_key (msymbol (p));
+      if (nkeys > n)
+	add_key (NULL);
+    }
+  free (line);
+}
+
+/* Array of measured times in microseconds.  */
+long *times;
+int ntimes, times_size;
+
+void
+add_time (struct timeval *tv0, struct timeval *tv1)
+{
+  if (ntimes == times_size)
+    {
+      times_size = times_size ? times_size * 2 : 1024;
+      times = realloc (times, sizeof (long) * times_size);
+      if (! times)
+	FATAL_ERROR ("%s\n", "Out of memory.");
+    }
+  times[ntimes++] = ((tv1->tv_sec - tv0->tv_sec) * 1000000
+		     + (tv1->tv_usec - tv0->tv_usec));
+}
+
+long
+elapsed (struct timeval *tv0, struct timeval *tv1)
+{
+  return ((tv1->tv_sec - tv0->tv_sec) * 1000000
+	  + (tv1->tv_usec - tv0->tv_usec));
+}
+
+int
+compare_time (const void *p1, const void *p2)
+{
+  long t1 = *(long *) p1, t2 = *(long *) p2;
+
+  return (t1 < t2 ? -1 : t1 > t2);
+}
+
+long
+percentile (int percent)
+{
+  int i = (ntimes * percent + 99) / 100 - 1;
+
+  return times[i < 0 ? 0 : i];
+}
+
+void
+print_text (MText *mt)
+{
+  static unsigned char *buf;
+  static int size;
+  MConverter *converter;
+  int n;
+
+  while (1)
+    {
+      if (! size)
+	size = 4096;
+      buf = realloc (buf, size);
+      if (! buf)
+	FATAL_ERROR ("%s\n", "Out of memory.");
+      converter = mconv_buffer_converter (Mcoding_utf_8, buf, size - 1);
+      if (! converter)
+	FATAL_ERROR ("%s\n", "Can't encode the text.");
+      n = mconv_encode (converter, mt);
+      if (converter->result != MCONVERSION_RESULT_INSUFFICIENT_DST)
+	break;
+      /* The buffer is too short.  Retry with a longer one.  */
+      mconv_free_converter (converter);
+      size *= 2;
+    }
+  mconv_free_converter (converter);
+  buf[n < 0 ? 0 : n] = '\0';
+  printf ("%s\n", buf);
+}
+
+int
+main (int argc, char **argv)
+{
+  MSymbol language = Mnil, name = Mnil;
+  FILE *in = stdin;
+  int count = 1, batch = 0, output = 0;
+  MInputMethod *im;
+  MInputContext *ic;
+  MText *mt;
+  struct timeval tv0, tv1;
+  struct rusage usage;
+  long open_time, total = 0;
+  int i, n;
+
+  M17N_INIT ();
+  if (merror_code != MERROR_NONE)
+    FATAL_ERROR ("%s\n", "Fail to initialize the m17n library.");
+
+  for (i = 1; i < argc; i++)
+    {
+      if (! strcmp (argv[i], "--help")
+	  || ! strcmp (argv[i], "-h")
+	  || ! strcmp (argv[i], "-?"))
+	help_exit (argv[0], 0);
+      else if (! strcmp (argv[i], "--version"))
+	{
+	  printf ("m17n-imbench (m17n library) %s\n", M17NLIB_VERSION_NAME);
+	  printf ("Copyright (C) 2026 AIST, JAPAN\n");
+	  exit (0);
+	}
+      else if (! strcmp (argv[i], "-r") && i + 1 < argc)
+	{
+	  count = atoi (argv[++i]);
+	  if (count <= 0)
+	    help_exit (argv[0], 1);
+	}
+      else if (! strcmp (argv[i], "-b"))
+	batch = 1;
+      else if (! strcmp (argv[i], "-o"))
+	output = 1;
+      else if (argv[i][0] != '-')
+	{
+	  if (language == Mnil)
+	    language = msymbol (argv[i]);
+	  else if (name == Mnil)
+	    name = msymbol (argv[i]);
+	  else if (in == stdin)
+	    {
+	      in = fopen (argv[i], "r");
+	      if (! in)
+		FATAL_ERROR ("Can't read the file %s\n", argv[i]);
+	    }
+	  else
+	    help_exit (argv[0], 1);
+	}
+      else
+	help_exit (argv[0], 1);
+    }
+  if (name == Mnil)
+    help_exit (argv[0], 1);
+
+  read_keys (in);
+  if (in != stdin)
+    fclose (in);
+  if (nkeys == 0)
+    FATAL_ERROR ("%s\n", "No key to replay.");
+
+  gettimeofday (&tv0, NULL);
+  im = minput_open_im (language, name, NULL);
+  ic = im ? minput_create_ic (im, NULL) : NULL;
+  gettimeofday (&tv1, NULL);
+  if (! ic)
+    FATAL_ERROR ("Can't open the input method %s\n", msymbol_name (name));
+  open_time = elapsed (&tv0, &tv1);
+
+  mt = mtext ();
+  while (count-- > 0)
+    for (i = 0; i < nkeys; i = n + 1)
+      {
+	for (n = i; keys[n]; n++);
+	if (batch)
+	  {
+	    gettimeofday (&tv0, NULL);
+	    minput_filter_batch (ic, keys + i, n - i, mt);
+	    gettimeofday (&tv1, NULL);
+	    add_time (&tv0, &tv1);
+	  }
+	else
+	  for (; i < n; i++)
+	    {
+	      gettimeofday (&tv0, NULL);
+	      if (minput_filter (ic, keys[i], NULL) == 0)
+		minput_lookup (ic, keys[i], NULL, mt);
+	      gettimeofday (&tv1, NULL);
+	      add_time (&tv0, &tv1);
+	    }
+	if (output)
+	  print_text (mt);
+	mtext_del (mt, 0, mtext_len (mt));
+	minput_reset_ic (ic);
+      }
+  /* Only the time spent in the input method is counted, not that for
+     printing and resetting.  */
+  for (i = 0; i < ntimes; i++)
+    total += times[i];
+
+  qsort (times, ntimes, sizeof (long), compare_time);
+  printf ("input method: %s-%s (opened in %ld usec)\n",
+	  msymbol_name (language), msymbol_name (name), open_time);
+  printf ("%s: %d, total: %ld usec\n", batch ? "lines" : "keys",
+	  ntimes, total);
+  printf ("usec per %s: mean %.1f, 50%% %ld, 90%% %ld, 99%% %ld, max %ld\n",
+	  batch ? "line" : "key", (double) total / ntimes,
+	  percentile (50), percentile (90), percentile (99),
+	  times[ntimes - 1]);
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    printf ("max resident set size: %ld KB\n", usage.ru_maxrss);
+
+  m17n_object_unref (mt);
+  minput_destroy_ic (ic);
+  minput_close_im (im);
+  free (keys);
+  free (times);
+  M17N_FINI ();
+  exit (0);
+}
+#endif /* not FOR_DOXYGEN */
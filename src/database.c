@@ -33,6 +33,18 @@
     specified by the environment variable "M17NDIR", or if it is not
     set, in the directory "~/.m17n.d".
 
+    The library caches some data (e.g. a catalog of font files) in the
+    directory specified by the environment variable "M17N_CACHE_DIR",
+    or if it is not set, in the directory "~/.m17n.d/cache".  If
+    "M17N_CACHE_DIR" is set to an empty string, nothing is cached.
+    Note that, unless "M17N_CACHE_DIR" is set, the library writes
+    under the home directory (creating "~/.m17n.d" if necessary) when
+    it lists fonts of the directories in #mfont_freetype_path without
+    using fontconfig.  The catalog of fonts of a directory is updated
+    only when the modification time of the directory changes, thus a
+    font file rewritten in place is not noticed until a file is added
+    to or removed from the directory.
+
     The m17n database contains multiple heterogeneous data, and each
     data is identified by four tags; TAG0, TAG1, TAG2, TAG3.  Each tag
     must be a symbol.
@@ -82,6 +94,18 @@
     ȤϡĶѿ "M17NDIR" ǻꤵǥ쥯ȥʻꤵƤ
     Ȥ "~/.m17n.d" Ȥǥ쥯ȥˤ̤Υǡ֤
 
+    饤֥ϰΥǡʥեȥեϿʤɡˤ򡢴Ķѿ
+    "M17N_CACHE_DIR" ǻꤵǥ쥯ȥʻꤵƤʤȤ
+    "~/.m17n.d/cache" Ȥǥ쥯ȥˤ˥å夹롣
+    "M17N_CACHE_DIR" ʸʤв⥭å夷ʤ
+    "M17N_CACHE_DIR" ꤵƤʤСfontconfig Ȥ鷺
+    #mfont_freetype_path Υǥ쥯ȥΥեȤ󤹤ݤˡ饤
+    ϥۡǥ쥯ȥβ˽񤭹ɬפʤ "~/.m17n.d" 
+    ˤȤաǥ쥯ȥΥեȤϿϥǥ쥯ȥι
+    郎ѤäȤˤΤ߹Τǡξǽ񤭴줿ե
+    ȥեϡǥ쥯ȥ˥ե뤬ɲäޤϺޤȿ
+    ʤ
+
     m17n 
     ǡ١ˤʣ¿ͤʥǡޤޤƤꡢƥǡ
     TAG0, TAG1, TAG2, TAG3ʤ٤ƥܥˤΣĤΥˤäƼ̤롣
@@ -400,6 +424,133 @@ get_database_file (MDatabaseInfo *db_info, struct stat *buf, int *result)
   return db_info->absolute_filename;
 }
 
+/* Directory to cache data (with a trailing separator), or NULL if
+   caching is disabled.  */
+static char *db_cache_dir;
+
+/* Version of the format of cache files.  */
+#define DB_CACHE_VERSION 2
+
+/* Return a newly allocated name of the cache file for NAME.  */
+
+static char *
+get_cache_file (char *name)
+{
+  unsigned hash = 0;
+  char *p, *file;
+
+  for (p = name; *p; p++)
+    hash = (hash << 5) - hash + (unsigned char) *p;
+  file = malloc (strlen (db_cache_dir) + 13);
+  if (file)
+    sprintf (file, "%s%08X.plc", db_cache_dir, hash);
+  return file;
+}
+
+/* Write in HEADER the header of the cache file for NAME, and return
+   the length.  A cache file is valid only if it starts with the
+   exactly same header.  */
+
+static int
+make_cache_header (char *header, char *name)
+{
+  return sprintf (header, "M17N-CACHE %d %s\n", DB_CACHE_VERSION, name);
+}
+
+/* Load a plist from the cache file for NAME.  Return NULL if there's
+   no valid cache.  */
+
+static MPlist *
+load_cache (char *name)
+{
+  char *file = get_cache_file (name);
+  char *header = alloca (strlen (name) + 64);
+  int len = make_cache_header (header, name);
+  struct stat buf;
+  unsigned char *data;
+  MPlist *plist = NULL;
+  FILE *fp;
+
+  if (! file)
+    return NULL;
+  fp = fopen (file, "r");
+  free (file);
+  if (! fp)
+    return NULL;
+  if (fstat (fileno (fp), &buf) == 0
+      && buf.st_size > len
+      && (data = malloc (buf.st_size)))
+    {
+      if (fread (data, 1, buf.st_size, fp) == buf.st_size
+	  && memcmp (data, header, len) == 0)
+	plist = mplist__from_binary (data + len, buf.st_size - len);
+      free (data);
+    }
+  fclose (fp);
+  return plist;
+}
+
+/* Save PLIST in the cache file for NAME.  The data is written in a
+   newly created temporary file, which is then renamed to the cache
+   file, so that the other processes never see a partially written
+   file, and a symbolic link placed in the cache directory is never
+   followed.  */
+
+static void
+save_cache (char *name, MPlist *plist)
+{
+  char *file = get_cache_file (name);
+  char *header = alloca (strlen (name) + 64);
+  char *temp_file;
+  FILE *fp = NULL;
+  int fd, ok;
+
+  if (! file)
+    return;
+  temp_file = malloc (strlen (file) + 8);
+  if (! temp_file)
+    {
+      free (file);
+      return;
+    }
+  sprintf (temp_file, "%s.XXXXXX", file);
+  fd = mkstemp (temp_file);
+  if (fd < 0)
+    {
+      char *str = strdup (db_cache_dir);
+
+      /* Make the cache directory (and its parent) if not yet made.  */
+      if (str)
+	{
+	  str[strlen (str) - 1] = '\0';
+	  mkdir (dirname (str), 0777);
+	  free (str);
+	}
+      if (mkdir (db_cache_dir, 0777) == 0)
+	{
+	  sprintf (temp_file, "%s.XXXXXX", file);
+	  fd = mkstemp (temp_file);
+	}
+    }
+  if (fd >= 0 && ! (fp = fdopen (fd, "w")))
+    {
+      close (fd);
+      unlink (temp_file);
+    }
+  if (fp)
+    {
+      make_cache_header (header, name);
+      fputs (header, fp);
+      ok = mplist__write_binary (plist, fp) == 0;
+      if (fclose (fp) != 0)
+	ok = 0;
+      if (! ok || rename (temp_file, file) < 0)
+	unlink (temp_file);
+    }
+  free (temp_file);
+  free (file);
+}
+
 static void *
 load_database (MSymbol *tags, void *extra_info)
 {
@@ -815,6 +966,34 @@ mdatabase__init ()
 	mplist_push (mdatabase__dir_list, Mt, get_dir_info (NULL));
     }
 
+  /* Data are cached in the directory specified by the environment
+     variable M17N_CACHE_DIR, or in "~/.m17n.d/cache/" if it is not
+     set.  */
+  path = getenv ("M17N_CACHE_DIR");
+  if (path)
+    {
+      int len = strlen (path);
+
+      if (len > 0 && (db_cache_dir = malloc (len + 2)))
+	{
+	  strcpy (db_cache_dir, path);
+	  if (db_cache_dir[len - 1] != PATH_SEPARATOR)
+	    db_cache_dir[len++] = PATH_SEPARATOR;
+	  db_cache_dir[len] = '\0';
+	}
+    }
+  else if ((path = getenv ("HOME")) && *path
+	   && (db_cache_dir = malloc (strlen (path) + 17)))
+    {
+      int len = strlen (path);
+
+      strcpy (db_cache_dir, path);
+      if (db_cache_dir[len - 1] != PATH_SEPARATOR)
+	db_cache_dir[len++] = PATH_SEPARATOR;
+      sprintf (db_cache_dir + len, ".m17n.d%ccache%c",
+	       PATH_SEPARATOR, PATH_SEPARATOR);
+    }
+
   mdatabase__list = mplist ();
   mdatabase__update ();
   return 0;
@@ -828,6 +1007,8 @@ mdatabase__fini (void)
   MPLIST_DO (plist, mdatabase__dir_list)
     free_db_info (MPLIST_VAL (plist));
   M17N_OBJECT_UNREF (mdatabase__dir_list);
+  free (db_cache_dir);
+  db_cache_dir = NULL;
 
   /* MDATABASE_LIST ::= ((TAG0 (TAG1 (TAG2 (TAG3 t:MDB) ...) ...) ...) ...) */
   MPLIST_DO (plist, mdatabase__list)
@@ -1220,6 +1401,26 @@ mdatabase__props (MDatabase *mdb)
   return db_info->properties;
 }
 
+/* Load a plist cached under NAME by mdatabase__save_cache ().  Return
+   NULL if there's no such cache.  The caller must check the validity
+   of the plist by itself.  */
+
+MPlist *
+mdatabase__load_cache (char *name)
+{
+  return (db_cache_dir ? load_cache (name) : NULL);
+}
+
+/* Cache PLIST under NAME in the cache directory.  PLIST must contain
+   only symbols, integers, M-texts, and plists.  */
+
+void
+mdatabase__save_cache (char *name, MPlist *plist)
+{
+  if (db_cache_dir)
+    save_cache (name, plist);
+}
+
 /*** @} */
 #endif /* !FOR_DOXYGEN || DOXYGEN_INTERNAL_MODULE */
 
@@ -90,6 +90,10 @@ extern int mdatabase__unlock (MDatabase *mdb);
 
 extern MPlist *mdatabase__props (MDatabase *mdb);
 
+extern MPlist *mdatabase__load_cache (char *name);
+
+extern void mdatabase__save_cache (char *name, MPlist *plist);
+
 extern void *(*mdatabase__load_charset_func) (FILE *fp, MSymbol charset_name);
 
 #endif /* not _M17N_DATABASE_H_ */
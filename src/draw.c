@@ -284,6 +284,8 @@ run_flt (MGlyphString *gstring, int from, int to, MRealizedFace *rface)
       APPEND_GLYPH (gstring, *MGLYPH (0));
       APPEND_GLYPH (gstring, *MGLYPH (0));
       gstring->used -= 2;
+      flt_gstr.glyphs = (MFLTGlyph *) (gstring->glyphs);
+      flt_gstr.allocated = gstring->size;
     }
   if (from + len != to)
     gstring->used += to - (from + len);
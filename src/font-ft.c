@@ -30,12 +30,16 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <ctype.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "m17n-gui.h"
 #include "m17n-misc.h"
 #include "internal.h"
 #include "plist.h"
 #include "symbol.h"
+#include "database.h"
 #include "language.h"
 #include "internal-flt.h"
 #include "internal-gui.h"
@@ -67,11 +71,29 @@ static FT_Library ft_library;
 #ifdef HAVE_OTF
 static OTF *invalid_otf = (OTF *) "";
 static OTF *get_otf (MFLTFont *font, FT_Face *ft_face);
+static void flush_otf_drive_memo (OTF *otf);
 #endif /* HAVE_OTF */
 
+/* Number of characters whose support is recorded in FTCoverage.  */
+#define FT_COVERAGE_CHARS 0x110000
+
+/* Set of Unicode characters supported by a font.  Characters are
+   grouped into blocks of 256 characters.  BLOCKS is the sorted array
+   of the numbers (C >> 8) of the blocks containing any supported
+   character, and BITS[I] is the bitmap of the block BLOCKS[I].  */
+
+typedef struct
+{
+  int nblocks;
+  unsigned short *blocks;
+  unsigned char (*bits)[32];
+} FTCoverage;
+
 typedef struct
 {
   MFont font;
+  /* NULL if not yet known.  */
+  FTCoverage *coverage;
 #ifdef HAVE_OTF
   /* NULL if not yet opened.  invalid_otf if not OTF.  */
   OTF *otf;
@@ -163,7 +185,10 @@ free_ft_info (MFontFT *ft_info)
 {
 #ifdef HAVE_OTF
   if (ft_info->otf && ft_info->otf != invalid_otf)
-    OTF_close (ft_info->otf);
+    {
+      flush_otf_drive_memo (ft_info->otf);
+      OTF_close (ft_info->otf);
+    }
 #endif /* HAVE_OTF */
 #ifdef HAVE_FONTCONFIG
   if (ft_info->langset)
@@ -171,6 +196,8 @@ free_ft_info (MFontFT *ft_info)
   if (ft_info->charset)
     FcCharSetDestroy (ft_info->charset);
 #endif	/* HAVE_FONTCONFIG */
+  if (ft_info->coverage)
+    free (ft_info->coverage);
   free (ft_info);
 }
 
@@ -237,8 +264,11 @@ ft_get_charmaps (FT_Face ft_face)
   return plist;
 }
 
+/* Return a newly allocated MFontFT for a font of FAMILY_NAME,
+   STYLE_NAME, and SIZE (in pixels) as FreeType reports.  */
+
 static MFontFT *
-ft_gen_font (FT_Face ft_face)
+ft_make_font (char *family_name, char *style_name, int size)
 {
   MFontFT *ft_info;
   MFont *font;
@@ -246,18 +276,10 @@ ft_gen_font (FT_Face ft_face)
   int bufsize = 0;
   char *stylename;
   MSymbol family;
-  int size;
-
-  if (FT_IS_SCALABLE (ft_face))
-    size = ft_face->size->metrics.y_ppem;
-  else if (ft_face->num_fixed_sizes == 0)
-    return NULL;
-  else
-    size = ft_face->available_sizes[0].height;
 
   MSTRUCT_CALLOC (ft_info, MERROR_FONT_FT);
   font = &ft_info->font;
-  STRDUP_LOWER (buf, bufsize, ft_face->family_name);
+  STRDUP_LOWER (buf, bufsize, family_name);
   family = msymbol (buf);
   mfont__set_property (font, MFONT_FAMILY, family);
   mfont__set_property (font, MFONT_WEIGHT, Mmedium);
@@ -270,7 +292,7 @@ ft_gen_font (FT_Face ft_face)
   font->source = MFONT_SOURCE_FT;
   font->file = NULL;
 
-  stylename = ft_face->style_name;
+  stylename = style_name;
   while (*stylename)
     {
       int i;
@@ -305,6 +327,202 @@ ft_gen_font (FT_Face ft_face)
   return ft_info;
 }
 
+/* Return the pixel size of FT_FACE for ft_make_font (), or -1 if
+   FT_FACE has no usable size.  */
+
+static int
+ft_face_size (FT_Face ft_face)
+{
+  if (FT_IS_SCALABLE (ft_face))
+    return ft_face->size->metrics.y_ppem;
+  if (ft_face->num_fixed_sizes == 0)
+    return -1;
+  return ft_face->available_sizes[0].height;
+}
+
+static MFontFT *
+ft_gen_font (FT_Face ft_face)
+{
+  int size = ft_face_size (ft_face);
+
+  if (size < 0)
+    return NULL;
+  return ft_make_font (ft_face->family_name, ft_face->style_name, size);
+}
+
+/* Compare the first characters of the ranges R1 and R2 for qsort.  */
+
+static int
+ft_range_compare (const void *r1, const void *r2)
+{
+  return (*(int *) r1 - *(int *) r2);
+}
+
+/* Return a newly allocated array of the ranges of Unicode characters
+   supported by FT_FACE, and set *NRANGES to the number of ranges.
+   The Ith range is from RANGES[I * 2] to RANGES[I * 2 + 1]
+   (inclusive), and the ranges are sorted and disjoint.  If memory is
+   exhausted, return NULL and set *NRANGES to -1.  This may run in a
+   thread other than the main one.  */
+
+static int *
+ft_face_ranges (FT_Face ft_face, int *nranges)
+{
+  FT_CharMap charmap = ft_face->charmap;
+  int *ranges = NULL;
+  int size = 0, n = 0, sorted = 1, i;
+  FT_ULong code;
+  FT_UInt idx;
+
+  *nranges = 0;
+  if (FT_Select_Charmap (ft_face, FT_ENCODING_UNICODE) != 0)
+    return NULL;
+  for (code = FT_Get_First_Char (ft_face, &idx); idx;
+       code = FT_Get_Next_Char (ft_face, code, &idx))
+    {
+      if (code >= FT_COVERAGE_CHARS)
+	continue;
+      if (n > 0 && code == ranges[n * 2 - 1] + 1)
+	{
+	  ranges[n * 2 - 1] = code;
+	  continue;
+	}
+      if (n > 0 && code <= ranges[n * 2 - 1])
+	/* FreeType usually returns characters in ascending order, but
+	   it's not guaranteed for all cmap formats.  */
+	sorted = 0;
+      if (n == size)
+	{
+	  int *new_ranges;
+
+	  size = size ? size * 2 : 64;
+	  new_ranges = realloc (ranges, sizeof (int) * 2 * size);
+	  if (! new_ranges)
+	    {
+	      free (ranges);
+	      ranges = NULL;
+	      n = -1;
+	      break;
+	    }
+	  ranges = new_ranges;
+	}
+      ranges[n * 2] = ranges[n * 2 + 1] = code;
+      n++;
+    }
+  if (! sorted && n > 0)
+    {
+      int j = 0;
+
+      qsort (ranges, n, sizeof (int) * 2, ft_range_compare);
+      for (i = 1; i < n; i++)
+	{
+	  if (ranges[i * 2] <= ranges[j * 2 + 1] + 1)
+	    {
+	      if (ranges[i * 2 + 1] > ranges[j * 2 + 1])
+		ranges[j * 2 + 1] = ranges[i * 2 + 1];
+	    }
+	  else
+	    {
+	      j++;
+	      ranges[j * 2] = ranges[i * 2];
+	      ranges[j * 2 + 1] = ranges[i * 2 + 1];
+	    }
+	}
+      n = j + 1;
+    }
+  *nranges = n;
+  if (charmap)
+    FT_Set_Charmap (ft_face, charmap);
+  return ranges;
+}
+
+/* Return a newly allocated FTCoverage for NRANGES ranges of
+   characters in RANGES as ft_face_ranges () returns.  */
+
+static FTCoverage *
+ft_coverage_new (int *ranges, int nranges)
+{
+  FTCoverage *coverage;
+  int nblocks = 0, last = -1, b = -1;
+  int i, c;
+
+  for (i = 0; i < nranges; i++)
+    {
+      int from = ranges[i * 2] >> 8, to = ranges[i * 2 + 1] >> 8;
+
+      nblocks += to - from + 1 - (from == last);
+      last = to;
+    }
+  coverage = calloc (sizeof (FTCoverage)
+		     + (sizeof (coverage->bits[0])
+			+ sizeof (coverage->blocks[0])) * nblocks, 1);
+  if (! coverage)
+    MEMORY_FULL (MERROR_FONT_FT);
+  coverage->nblocks = nblocks;
+  coverage->bits = (unsigned char (*)[32]) (coverage + 1);
+  coverage->blocks = (unsigned short *) (coverage->bits + nblocks);
+  for (i = 0; i < nranges; i++)
+    for (c = ranges[i * 2]; c <= ranges[i * 2 + 1]; c++)
+      {
+	if (b < 0 || coverage->blocks[b] != c >> 8)
+	  coverage->blocks[++b] = c >> 8;
+	coverage->bits[b][(c & 0xFF) >> 3] |= 1 << (c & 7);
+      }
+  return coverage;
+}
+
+/* Return 1 iff the character C is in COVERAGE.  */
+
+static int
+ft_coverage_has_char (FTCoverage *coverage, int c)
+{
+  int block = c >> 8;
+  int low = 0, high = coverage->nblocks;
+
+  if (c < 0 || c >= FT_COVERAGE_CHARS)
+    return 0;
+  while (low < high)
+    {
+      int mid = (low + high) / 2;
+
+      if (coverage->blocks[mid] < block)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+  return (low < coverage->nblocks && coverage->blocks[low] == block
+	  && (coverage->bits[low][(c & 0xFF) >> 3] & (1 << (c & 7))));
+}
+
+/* Return the coverage of the font FT_INFO.  If it is not yet known,
+   get it from FT_FACE, or from the font file if FT_FACE is NULL.
+   Return NULL if the file can't be opened.  */
+
+static FTCoverage *
+ft_coverage (MFontFT *ft_info, FT_Face ft_face)
+{
+  int *ranges, nranges;
+  int ft_face_allocated = 0;
+
+  if (ft_info->coverage)
+    return ft_info->coverage;
+  if (! ft_face)
+    {
+      if (FT_New_Face (ft_library, MSYMBOL_NAME (ft_info->font.file), 0,
+		       &ft_face))
+	return NULL;
+      ft_face_allocated = 1;
+    }
+  ranges = ft_face_ranges (ft_face, &nranges);
+  if (ft_face_allocated)
+    FT_Done_Face (ft_face);
+  if (nranges < 0)
+    MEMORY_FULL (MERROR_FONT_FT);
+  ft_info->coverage = ft_coverage_new (ranges, nranges);
+  free (ranges);
+  return ft_info->coverage;
+}
+
 #ifdef HAVE_FONTCONFIG
 
 typedef struct
@@ -620,29 +838,15 @@ fc_build_charset (MPlist *char_list, MText *mt)
 
 #else	/* not HAVE_FONTCONFIG */
 
+/* Add FT_INFO to ft_font_list, and return the element of ft_font_list
+   for the family of FT_INFO.  */
+
 static MPlist *
-ft_add_font (char *filename)
+ft_register_font (MFontFT *ft_info)
 {
-  FT_Face ft_face;
-  char *stylename;
-  int size = 0;
-  MSymbol family;
-  MFontFT *ft_info;
-  MFont *font;
+  MFont *font = &ft_info->font;
+  MSymbol family = FONT_PROPERTY (font, MFONT_FAMILY);
   MPlist *plist;
-  int i;
-  char *buf;
-  int bufsize = 0;
-
-  if (FT_New_Face (ft_library, filename, 0, &ft_face) != 0)
-    return NULL;
-  ft_info = ft_gen_font (ft_face);
-  FT_Done_Face (ft_face);
-  if (! ft_info)
-    return NULL;
-
-  font = &ft_info->font;
-  font->file = msymbol (filename);
 
   plist = mplist_find_by_key (ft_font_list, family);
   if (plist)
@@ -656,14 +860,477 @@ ft_add_font (char *filename)
   return plist;
 }
 
+/* Open the font file FILENAME and return a newly allocated MFontFT
+   for it, or NULL if it is not a font file.  */
+
+static MFontFT *
+ft_load_font (char *filename)
+{
+  FT_Face ft_face;
+  MFontFT *ft_info;
+
+  if (FT_New_Face (ft_library, filename, 0, &ft_face) != 0)
+    return NULL;
+  ft_info = ft_gen_font (ft_face);
+  FT_Done_Face (ft_face);
+  if (ft_info)
+    ft_info->font.file = msymbol (filename);
+  return ft_info;
+}
+
+static MPlist *
+ft_add_font (char *filename)
+{
+  MFontFT *ft_info = ft_load_font (filename);
+
+  return (ft_info ? ft_register_font (ft_info) : NULL);
+}
+
+/* The catalog of fonts in a directory of mfont_freetype_path is
+   cached by mdatabase__save_cache () under the name
+   FT_CATALOG_PREFIX followed by the directory name, in this form:
+
+	(DIR-MTIME ENTRY ...)
+	ENTRY ::= (FILE MTIME SIZE [ PROPERTY ... FONT-SIZE [ COVERAGE ] ])
+	COVERAGE ::= (FROM TO ...)
+
+   DIR-MTIME is the modification time of the directory.  FILE is a
+   symbol of a file name in the directory, and MTIME and SIZE are
+   from the status of the file.  If the file is a font, PROPERTYs are
+   symbols of the font properties MFONT_FOUNDRY to MFONT_REGISTRY, and
+   FONT-SIZE is MFont->size.  COVERAGE lists the ranges of Unicode
+   characters supported by the font (see ft_face_ranges ()), from
+   which FTCoverage is made without opening the file.  The catalog is
+   used as is while DIR-MTIME is the same as the current one, thus a
+   font file rewritten in place is not noticed until the directory
+   changes.  Otherwise, only files of different MTIME or SIZE are
+   opened again.  */
+
+#define FT_CATALOG_PREFIX "font-ft:"
+
+/* Return a catalog entry for the file FILE of STATBUF.  The entry
+   is for a file that is not a font until ft_catalog_add_font () is
+   called.  */
+
+static MPlist *
+ft_catalog_entry (MSymbol file, struct stat *statbuf)
+{
+  MPlist *entry = mplist ();
+
+  mplist_add (entry, Msymbol, file);
+  mplist_add (entry, Minteger, (void *) (int) statbuf->st_mtime);
+  mplist_add (entry, Minteger, (void *) (int) statbuf->st_size);
+  return entry;
+}
+
+/* Add the properties of FT_INFO to the catalog entry ENTRY.  RANGES
+   and NRANGES are what ft_face_ranges () returned for the font.  */
+
+static void
+ft_catalog_add_font (MPlist *entry, MFontFT *ft_info,
+		     int *ranges, int nranges)
+{
+  MPlist *coverage;
+  int i;
+
+  for (i = MFONT_FOUNDRY; i <= MFONT_REGISTRY; i++)
+    mplist_add (entry, Msymbol, FONT_PROPERTY (&ft_info->font, i));
+  mplist_add (entry, Minteger, (void *) ft_info->font.size);
+  if (nranges < 0)
+    return;
+  coverage = mplist ();
+  for (i = 0; i < nranges * 2; i++)
+    mplist_add (coverage, Minteger, (void *) ranges[i]);
+  mplist_add (entry, Mplist, coverage);
+  M17N_OBJECT_UNREF (coverage);
+}
+
+/* Return a newly allocated FTCoverage made from COVERAGE of a
+   catalog entry, or NULL if COVERAGE is malformed.  */
+
+static FTCoverage *
+ft_catalog_coverage (MPlist *coverage)
+{
+  FTCoverage *ft_coverage;
+  int *ranges;
+  int nranges = 0, last = -1;
+  MPlist *p;
+
+  MPLIST_DO (p, coverage)
+    {
+      int from, to;
+
+      if (! MPLIST_INTEGER_P (p) || MPLIST_TAIL_P (MPLIST_NEXT (p))
+	  || ! MPLIST_INTEGER_P (MPLIST_NEXT (p)))
+	return NULL;
+      from = MPLIST_INTEGER (p);
+      p = MPLIST_NEXT (p);
+      to = MPLIST_INTEGER (p);
+      if (from <= last || to < from || to >= FT_COVERAGE_CHARS)
+	return NULL;
+      last = to;
+      nranges++;
+    }
+  MTABLE_MALLOC (ranges, nranges * 2 + 1, MERROR_FONT_FT);
+  nranges = 0;
+  MPLIST_DO (p, coverage)
+    ranges[nranges++] = MPLIST_INTEGER (p);
+  ft_coverage = ft_coverage_new (ranges, nranges / 2);
+  free (ranges);
+  return ft_coverage;
+}
+
+/* Return 1 iff PLIST is an element of a catalog that holds a
+   well-formed entry.  */
+
+static int
+ft_catalog_entry_p (MPlist *plist)
+{
+  MPlist *entry;
+
+  if (! MPLIST_PLIST_P (plist))
+    return 0;
+  entry = MPLIST_PLIST (plist);
+  return (MPLIST_SYMBOL_P (entry)
+	  && MPLIST_INTEGER_P (MPLIST_NEXT (entry))
+	  && MPLIST_INTEGER_P (MPLIST_NEXT (MPLIST_NEXT (entry))));
+}
+
+/* Return a newly allocated MFontFT for the file FILENAME made from
+   the catalog entry ENTRY, or NULL if ENTRY is not for a font.  */
+
+static MFontFT *
+ft_catalog_font (MPlist *entry, char *filename)
+{
+  MFontFT *ft_info;
+  MPlist *p = MPLIST_NEXT (MPLIST_NEXT (MPLIST_NEXT (entry)));
+  MPlist *pl;
+  int i;
+
+  for (i = MFONT_FOUNDRY, pl = p; i <= MFONT_REGISTRY;
+       i++, pl = MPLIST_NEXT (pl))
+    if (! MPLIST_SYMBOL_P (pl))
+      return NULL;
+  if (! MPLIST_INTEGER_P (pl))
+    return NULL;
+  MSTRUCT_CALLOC (ft_info, MERROR_FONT_FT);
+  for (i = MFONT_FOUNDRY; i <= MFONT_REGISTRY; i++, p = MPLIST_NEXT (p))
+    mfont__set_property (&ft_info->font, i, MPLIST_SYMBOL (p));
+  ft_info->font.size = MPLIST_INTEGER (p);
+  p = MPLIST_NEXT (p);
+  if (MPLIST_PLIST_P (p))
+    ft_info->coverage = ft_catalog_coverage (MPLIST_PLIST (p));
+  ft_info->font.type = MFONT_TYPE_OBJECT;
+  ft_info->font.source = MFONT_SOURCE_FT;
+  ft_info->font.file = msymbol (filename);
+  return ft_info;
+}
+
+/* Information of a font file read by ft_probe_font ().  */
+
+typedef struct
+{
+  char *path;
+
+  /* Nonzero if the file must be opened, i.e. the catalog has no valid
+     entry for it.  */
+  int probe;
+
+  /* Set by ft_probe_font ().  FAMILY_NAME is NULL if the file is not
+     a font.  RANGES and NRANGES are from ft_face_ranges ().  */
+  char *family_name, *style_name;
+  int size;
+  int *ranges, nranges;
+} FTProbe;
+
+/* Open PROBE->path by LIBRARY and set the other members of PROBE.
+   This may run in a thread other than the main one, and thus must not
+   touch anything but PROBE and LIBRARY.  */
+
+static void
+ft_probe_font (FT_Library library, FTProbe *probe)
+{
+  FT_Face ft_face;
+
+  if (FT_New_Face (library, probe->path, 0, &ft_face) != 0)
+    return;
+  probe->size = ft_face_size (ft_face);
+  if (probe->size >= 0 && ft_face->family_name)
+    {
+      probe->family_name = strdup (ft_face->family_name);
+      probe->style_name = strdup (ft_face->style_name
+				  ? ft_face->style_name : "");
+      if (! probe->family_name || ! probe->style_name)
+	{
+	  free (probe->family_name);
+	  free (probe->style_name);
+	  probe->family_name = probe->style_name = NULL;
+	}
+      else
+	probe->ranges = ft_face_ranges (ft_face, &probe->nranges);
+    }
+  FT_Done_Face (ft_face);
+}
+
+#ifdef HAVE_PTHREAD
+
+/* Maximum number of threads to probe font files.  */
+#define FT_PROBE_THREADS_MAX 32
+
+/* Minimum number of files to probe per thread.  */
+#define FT_PROBE_MIN_FILES 16
+
+typedef struct
+{
+  FTProbe *probes;
+  int nprobes, start, step;
+  /* Set to 1 when all the probes are done.  */
+  int done;
+} FTProbeJob;
+
+static void *
+ft_probe_thread (void *arg)
+{
+  FTProbeJob *job = arg;
+  FT_Library library;
+  int i;
+
+  /* A FreeType library object can't be shared among threads.  */
+  if (FT_Init_FreeType (&library) != 0)
+    return NULL;
+  for (i = job->start; i < job->nprobes; i += job->step)
+    if (job->probes[i].probe)
+      ft_probe_font (library, job->probes + i);
+  FT_Done_FreeType (library);
+  job->done = 1;
+  return NULL;
+}
+
+#endif	/* HAVE_PTHREAD */
+
+/* Call ft_probe_font () for the elements of PROBES whose member
+   <probe> is nonzero.  COUNT is the number of such elements.  Files
+   are opened by multiple threads if available.  The result doesn't
+   depend on the number of threads.  */
+
+static void
+ft_probe_fonts (FTProbe *probes, int nprobes, int count)
+{
+  int i;
+#ifdef HAVE_PTHREAD
+  pthread_t threads[FT_PROBE_THREADS_MAX];
+  FTProbeJob jobs[FT_PROBE_THREADS_MAX];
+  int created[FT_PROBE_THREADS_MAX];
+  int nthreads = count / FT_PROBE_MIN_FILES, k;
+#ifdef _SC_NPROCESSORS_ONLN
+  long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (nthreads > ncpus)
+    nthreads = ncpus;
+#else  /* not _SC_NPROCESSORS_ONLN */
+  nthreads = 1;
+#endif	/* not _SC_NPROCESSORS_ONLN */
+  if (nthreads > FT_PROBE_THREADS_MAX)
+    nthreads = FT_PROBE_THREADS_MAX;
+  if (nthreads > 1)
+    {
+      for (k = 0; k < nthreads; k++)
+	{
+	  jobs[k].probes = probes;
+	  jobs[k].nprobes = nprobes;
+	  jobs[k].start = k;
+	  jobs[k].step = nthreads;
+	  jobs[k].done = 0;
+	  created[k] = pthread_create (threads + k, NULL,
+				       ft_probe_thread, jobs + k) == 0;
+	}
+      for (k = 0; k < nthreads; k++)
+	if (created[k])
+	  pthread_join (threads[k], NULL);
+      /* Do the jobs of the threads that failed.  */
+      for (k = 0; k < nthreads; k++)
+	if (! jobs[k].done)
+	  for (i = k; i < nprobes; i += nthreads)
+	    if (probes[i].probe && ! probes[i].family_name)
+	      ft_probe_font (ft_library, probes + i);
+      return;
+    }
+#endif	/* HAVE_PTHREAD */
+  for (i = 0; i < nprobes; i++)
+    if (probes[i].probe)
+      ft_probe_font (ft_library, probes + i);
+}
+
+/* Find the entry for FILE in the entries ENTRIES of a catalog.  The
+   search starts at *NEXT, which is then updated to the element after
+   the found one; catalogs are in the order of readdir (), so the
+   search usually succeeds at once.  */
+
+static MPlist *
+ft_catalog_find (MPlist *entries, MPlist **next, MSymbol file)
+{
+  MPlist *pl;
+
+  for (pl = *next; ! MPLIST_TAIL_P (pl); pl = MPLIST_NEXT (pl))
+    if (ft_catalog_entry_p (pl)
+	&& MPLIST_SYMBOL (MPLIST_PLIST (pl)) == file)
+      goto found;
+  for (pl = entries; pl != *next; pl = MPLIST_NEXT (pl))
+    if (ft_catalog_entry_p (pl)
+	&& MPLIST_SYMBOL (MPLIST_PLIST (pl)) == file)
+      goto found;
+  return NULL;
+
+ found:
+  *next = MPLIST_NEXT (pl);
+  return MPLIST_PLIST (pl);
+}
+
+/* Add fonts in the directory DIRNAME of DIRSTAT to ft_font_list by
+   the catalog of the directory, updating the catalog if
+   necessary.  */
+
+static void
+ft_add_directory (char *dirname, struct stat *dirstat)
+{
+  int len = strlen (dirname);
+  char *name = alloca (len + sizeof FT_CATALOG_PREFIX);
+  MPlist *catalog, *entries, *next, *new_catalog, *pl;
+  DIR *dir;
+  struct dirent *dp;
+  char *path = NULL;
+  FTProbe *probes = NULL;
+  MPlist **probe_entries = NULL;
+  int nprobes = 0, size = 0, count = 0, i;
+  USE_SAFE_ALLOCA;
+
+  sprintf (name, "%s%s", FT_CATALOG_PREFIX, dirname);
+  catalog = mdatabase__load_cache (name);
+  if (catalog && ! MPLIST_INTEGER_P (catalog))
+    {
+      M17N_OBJECT_UNREF (catalog);
+      catalog = NULL;
+    }
+  entries = catalog ? MPLIST_NEXT (catalog) : NULL;
+
+  if (catalog && MPLIST_INTEGER (catalog) == (int) dirstat->st_mtime)
+    {
+      MDEBUG_PRINT1 (" [FONT-FT] catalog of %s is up to date\n", dirname);
+      MPLIST_DO (pl, entries)
+	if (ft_catalog_entry_p (pl))
+	  {
+	    MPlist *entry = MPLIST_PLIST (pl);
+	    char *file = MSYMBOL_NAME (MPLIST_SYMBOL (entry));
+	    MFontFT *ft_info;
+
+	    SAFE_ALLOCA (path, len + strlen (file) + 2);
+	    sprintf (path, "%s/%s", dirname, file);
+	    ft_info = ft_catalog_font (entry, path);
+	    if (ft_info)
+	      ft_register_font (ft_info);
+	  }
+      M17N_OBJECT_UNREF (catalog);
+      SAFE_FREE (path);
+      return;
+    }
+
+  dir = opendir (dirname);
+  if (! dir)
+    {
+      M17N_OBJECT_UNREF (catalog);
+      return;
+    }
+  MDEBUG_PRINT1 (" [FONT-FT] updating catalog of %s\n", dirname);
+
+  /* At first, list the files, and find which of them must be
+     opened.  */
+  next = entries;
+  while ((dp = readdir (dir)) != NULL)
+    {
+      struct stat statbuf;
+      MSymbol file;
+      MPlist *entry = NULL;
+
+      SAFE_ALLOCA (path, len + strlen (dp->d_name) + 2);
+      sprintf (path, "%s/%s", dirname, dp->d_name);
+      if (stat (path, &statbuf) != 0 || ! S_ISREG (statbuf.st_mode))
+	continue;
+      file = msymbol (dp->d_name);
+      if (entries)
+	entry = ft_catalog_find (entries, &next, file);
+      if (nprobes == size)
+	{
+	  size = size ? size * 2 : 64;
+	  MTABLE_REALLOC (probes, size, MERROR_FONT_FT);
+	  MTABLE_REALLOC (probe_entries, size, MERROR_FONT_FT);
+	}
+      memset (probes + nprobes, 0, sizeof (FTProbe));
+      probes[nprobes].path = strdup (path);
+      if (entry
+	  && MPLIST_INTEGER (MPLIST_NEXT (entry)) == (int) statbuf.st_mtime
+	  && (MPLIST_INTEGER (MPLIST_NEXT (MPLIST_NEXT (entry)))
+	      == (int) statbuf.st_size))
+	{
+	  M17N_OBJECT_REF (entry);
+	  probe_entries[nprobes] = entry;
+	}
+      else
+	{
+	  probes[nprobes].probe = 1;
+	  probe_entries[nprobes] = ft_catalog_entry (file, &statbuf);
+	  count++;
+	}
+      nprobes++;
+    }
+  closedir (dir);
+
+  /* Then open the files.  */
+  ft_probe_fonts (probes, nprobes, count);
+
+  /* Finally, register the fonts in the order of the directory.  */
+  new_catalog = mplist ();
+  mplist_add (new_catalog, Minteger, (void *) (int) dirstat->st_mtime);
+  for (i = 0; i < nprobes; i++)
+    {
+      FTProbe *probe = probes + i;
+      MPlist *entry = probe_entries[i];
+      MFontFT *ft_info = NULL;
+
+      if (! probe->probe)
+	ft_info = ft_catalog_font (entry, probe->path);
+      else if (probe->family_name)
+	{
+	  ft_info = ft_make_font (probe->family_name, probe->style_name,
+				  probe->size);
+	  ft_info->font.file = msymbol (probe->path);
+	  if (probe->nranges >= 0)
+	    ft_info->coverage = ft_coverage_new (probe->ranges,
+						 probe->nranges);
+	  ft_catalog_add_font (entry, ft_info, probe->ranges, probe->nranges);
+	  free (probe->family_name);
+	  free (probe->style_name);
+	  free (probe->ranges);
+	}
+      mplist_add (new_catalog, Mplist, entry);
+      M17N_OBJECT_UNREF (entry);
+      free (probe->path);
+      if (ft_info)
+	ft_register_font (ft_info);
+    }
+  free (probes);
+  free (probe_entries);
+  mdatabase__save_cache (name, new_catalog);
+  M17N_OBJECT_UNREF (new_catalog);
+  M17N_OBJECT_UNREF (catalog);
+  SAFE_FREE (path);
+}
+
 static void
 ft_init_font_list (void)
 {
   MPlist *plist;
   struct stat buf;
   char *pathname;
-  char *path;
-  USE_SAFE_ALLOCA;
 
   ft_font_list = mplist ();
   MPLIST_DO (plist, mfont_freetype_path)
@@ -674,27 +1341,8 @@ ft_init_font_list (void)
 	if (S_ISREG (buf.st_mode))
 	  ft_add_font (pathname);
 	else if (S_ISDIR (buf.st_mode))
-	  {
-	    DIR *dir = opendir (pathname);
-
-	    if (dir)
-	      {
-		int len = strlen (pathname);
-		struct dirent *dp;
-
-		while ((dp = readdir (dir)) != NULL)
-		  {
-		    SAFE_ALLOCA (path, len + strlen (dp->d_name) + 2);
-		    strcpy (path, pathname);
-		    path[len] =  '/';
-		    strcpy (path + len + 1, dp->d_name);
-		    ft_add_font (path);
-		  }
-		closedir (dir);
-	      }
-	  }
+	  ft_add_directory (pathname, &buf);
       }
-  SAFE_FREE (path);
 }
 
 /* Return 1 iff the font pointed by FT_INFO has all characters in
@@ -703,15 +1351,14 @@ ft_init_font_list (void)
 static int
 ft_has_char_list_p (MFontFT *ft_info, MPlist *char_list)
 {
-  FT_Face ft_face;
+  FTCoverage *coverage = ft_coverage (ft_info, NULL);
   MPlist *cl;
 
-  if (FT_New_Face (ft_library, MSYMBOL_NAME (ft_info->font.file), 0, &ft_face))
+  if (! coverage)
     return 0;
   MPLIST_DO (cl, char_list)
-    if (FT_Get_Char_Index (ft_face, (FT_ULong) MPLIST_INTEGER (cl)) == 0)
+    if (! ft_coverage_has_char (coverage, MPLIST_INTEGER (cl)))
       break;
-  FT_Done_Face (ft_face);
   return MPLIST_TAIL_P (cl);
 }
 
@@ -1084,7 +1731,7 @@ ft_check_language (MFontFT *ft_info, MSymbol language, FT_Face ft_face)
 {
   MText *mt;
   MText *extra;
-  int ft_face_allocaed = 0;
+  FTCoverage *coverage;
   int len, total_len;
   int i;
 
@@ -1100,14 +1747,9 @@ ft_check_language (MFontFT *ft_info, MSymbol language, FT_Face ft_face)
   if (! mt || mtext_nchars (mt) == 0)
     return -1;
 
-  if (! ft_face)
-    {
-      char *filename = MSYMBOL_NAME (ft_info->font.file);
-
-      if (FT_New_Face (ft_library, filename, 0, &ft_face))
-	return -1;
-      ft_face_allocaed = 1;
-    }
+  coverage = ft_coverage (ft_info, ft_face);
+  if (! coverage)
+    return -1;
 
   len = mtext_nchars (mt);
   extra = mtext_get_prop (mt, 0, Mtext);
@@ -1123,13 +1765,10 @@ ft_check_language (MFontFT *ft_info, MSymbol language, FT_Face ft_face)
 	  && FcCharSetHasChar (ft_info->charset, (FcChar32) c) == FcFalse)
 	break;
 #endif	/* HAVE_FONTCONFIG */
-      if (FT_Get_Char_Index (ft_face, (FT_ULong) c) == 0)
+      if (! ft_coverage_has_char (coverage, c))
 	break;
     }
 
-  if (ft_face_allocaed)
-    FT_Done_Face (ft_face);
-
   return (i == total_len ? 0 : -1);
 }
 
@@ -1151,23 +1790,13 @@ ft_check_script (MFontFT *ft_info, MSymbol script, FT_Face ft_face)
   else
 #endif	/* HAVE_FONTCONFIG */
     {
-      int ft_face_allocaed = 0;
-
-      if (! ft_face)
-	{
-	  char *filename = MSYMBOL_NAME (ft_info->font.file);
-
-	  if (FT_New_Face (ft_library, filename, 0, &ft_face))
-	    return -1;
-	  ft_face_allocaed = 1;
-	}
+      FTCoverage *coverage = ft_coverage (ft_info, ft_face);
 
+      if (! coverage)
+	return -1;
       MPLIST_DO (char_list, char_list)
-	if (FT_Get_Char_Index (ft_face, (FT_ULong) MPLIST_INTEGER (char_list))
-	    == 0)
+	if (! ft_coverage_has_char (coverage, MPLIST_INTEGER (char_list)))
 	  break;
-      if (ft_face_allocaed)
-	FT_Done_Face (ft_face);
     }
 
   return (MPLIST_TAIL_P (char_list) ? 0 : -1);
@@ -1547,6 +2176,7 @@ ft_open (MFrame *frame, MFont *font, MFont *spec, MRealizedFont *rfont)
   rfont->driver = &mfont__ft_driver;
   rfont->info = ft_rfont;
   rfont->fontp = ft_face;
+  rfont->metric_cache = mfont__metric_cache (ft_face->num_glyphs);
   rfont->ascent = ft_face->size->metrics.ascender;
   rfont->descent = - ft_face->size->metrics.descender;
   rfont->max_advance = ft_face->size->metrics.max_advance;
@@ -1632,6 +2262,8 @@ ft_find_metric (MRealizedFont *rfont, MGlyphString *gstring,
 	{
 	  FT_Glyph_Metrics *metrics;
 
+	  if (mfont__lookup_metric (rfont, g))
+	    continue;
 	  FT_Load_Glyph (ft_face, (FT_UInt) g->g.code, FT_LOAD_DEFAULT);
 	  metrics = &ft_face->glyph->metrics;
 	  g->g.lbearing = metrics->horiBearingX;
@@ -1644,6 +2276,7 @@ ft_find_metric (MRealizedFont *rfont, MGlyphString *gstring,
       g->g.ascent += rfont->baseline_offset;
       g->g.descent -= rfont->baseline_offset;
       g->g.measured = 1;
+      mfont__store_metric (rfont, g);
     }
 }
 
@@ -1687,6 +2320,17 @@ ft_has_char (MFrame *frame, MFont *font, MFont *spec, int c, unsigned code)
 	    }
 	  return (FcCharSetHasChar (ft_info->charset, (FcChar32) c) == FcTrue);
 #else  /* not HAVE_FONTCONFIG */
+	  MSymbol registry = FONT_PROPERTY (spec, MFONT_REGISTRY);
+
+	  /* The coverage is of the Unicode charmap, which ft_open ()
+	     selects for these registries.  */
+	  if (registry == Mnil || registry == Municode_bmp
+	      || registry == Municode_full)
+	    {
+	      FTCoverage *coverage = ft_coverage ((MFontFT *) font, NULL);
+
+	      return (coverage && ft_coverage_has_char (coverage, code));
+	    }
 	  rfont = ft_open (frame, font, spec, NULL);
 #endif	/* not HAVE_FONTCONFIG */
 	}
@@ -2138,6 +2782,11 @@ ft_close (MRealizedFont *rfont)
 {
   if (! rfont->encapsulating)
     return;
+#ifdef HAVE_OTF
+  if (((MFontFT *) rfont->font)->otf
+      && ((MFontFT *) rfont->font)->otf != invalid_otf)
+    flush_otf_drive_memo (((MFontFT *) rfont->font)->otf);
+#endif	/* HAVE_OTF */
   free (rfont->font);
   M17N_OBJECT_UNREF (rfont->info);
   free (rfont);
@@ -2235,6 +2884,274 @@ get_otf (MFLTFont *font, FT_Face *ft_face)
   return (otf == invalid_otf ? NULL : otf);
 }
 
+/* Memo of the results of driving GSUB and GPOS tables.  They depend
+   only on OTF, script, langsys, features, and the input glyphs (not
+   on the font size), and libotf is the most expensive part of
+   ft_drive_otf (), which is called again and again for the same
+   syllables.  */
+
+typedef struct OTFDriveMemo OTFDriveMemo;
+
+struct OTFDriveMemo
+{
+  /* Next memo in the same bucket of otf_drive_memo_table.  */
+  OTFDriveMemo *next;
+  /* Neighbours in the list of memos sorted by the recentness of
+     use.  */
+  OTFDriveMemo *prev_used, *next_used;
+  unsigned hash;
+
+  /* Key.  INPUT has LEN pairs of a character code and a glyph
+     ID.  */
+  OTF *otf;
+  unsigned script, langsys;
+  char *gsub_features, *gpos_features;
+  int len;
+  unsigned *input;
+
+  /* Return values of OTF_drive_gsub_with_log () and
+     OTF_drive_gpos_with_log ().  */
+  int gsub_result, gpos_result;
+  /* Glyphs after GSUB (valid only if GSUB_FEATURES is non-NULL), and
+     after GPOS (valid only if GPOS_FEATURES is non-NULL).  */
+  OTF_GlyphString gsub, gpos;
+};
+
+#define OTF_DRIVE_MEMO_BUCKETS 1024
+
+/* Maximum number of glyphs kept in all memos.  */
+#define OTF_DRIVE_MEMO_GLYPHS 0x10000
+
+static OTFDriveMemo *otf_drive_memo_table[OTF_DRIVE_MEMO_BUCKETS];
+
+/* The most recently and the least recently used memos.  */
+static OTFDriveMemo *otf_drive_memo_head, *otf_drive_memo_tail;
+
+static int otf_drive_memo_glyphs;
+
+static unsigned
+otf_drive_memo_hash (OTF *otf, unsigned script, unsigned langsys,
+		     char *gsub_features, char *gpos_features,
+		     unsigned *input, int len)
+{
+  unsigned hash = (unsigned) (unsigned long) otf;
+  int i;
+
+  hash = hash * 31 + script;
+  hash = hash * 31 + langsys;
+  if (gsub_features)
+    for (i = 0; gsub_features[i]; i++)
+      hash = hash * 31 + gsub_features[i];
+  hash = hash * 31 + '/';
+  if (gpos_features)
+    for (i = 0; gpos_features[i]; i++)
+      hash = hash * 31 + gpos_features[i];
+  for (i = 0; i < len * 2; i++)
+    hash = hash * 31 + input[i];
+  return hash;
+}
+
+static int
+otf_drive_memo_match (OTFDriveMemo *memo, unsigned hash,
+		      OTF *otf, unsigned script, unsigned langsys,
+		      char *gsub_features, char *gpos_features,
+		      unsigned *input, int len)
+{
+  return (memo->hash == hash
+	  && memo->otf == otf
+	  && memo->script == script
+	  && memo->langsys == langsys
+	  && memo->len == len
+	  && (memo->gsub_features
+	      ? (gsub_features && ! strcmp (memo->gsub_features, gsub_features))
+	      : ! gsub_features)
+	  && (memo->gpos_features
+	      ? (gpos_features && ! strcmp (memo->gpos_features, gpos_features))
+	      : ! gpos_features)
+	  && ! memcmp (memo->input, input, sizeof (unsigned) * len * 2));
+}
+
+static void
+free_otf_drive_memo (OTFDriveMemo *memo)
+{
+  OTFDriveMemo **p = otf_drive_memo_table + (memo->hash
+					     % OTF_DRIVE_MEMO_BUCKETS);
+
+  while (*p != memo)
+    p = &(*p)->next;
+  *p = memo->next;
+  if (memo->prev_used)
+    memo->prev_used->next_used = memo->next_used;
+  else
+    otf_drive_memo_head = memo->next_used;
+  if (memo->next_used)
+    memo->next_used->prev_used = memo->prev_used;
+  else
+    otf_drive_memo_tail = memo->prev_used;
+  otf_drive_memo_glyphs -= memo->len;
+  if (memo->gsub.glyphs)
+    free (memo->gsub.glyphs);
+  if (memo->gpos.glyphs)
+    free (memo->gpos.glyphs);
+  free (memo);
+}
+
+/* Free all memos of OTF.  If OTF is NULL, free all memos.  This must
+   be called before OTF is closed because the memos of GPOS results
+   point into the data of OTF.  */
+
+static void
+flush_otf_drive_memo (OTF *otf)
+{
+  OTFDriveMemo *memo, *next;
+
+  for (memo = otf_drive_memo_head; memo; memo = next)
+    {
+      next = memo->next_used;
+      if (! otf || memo->otf == otf)
+	free_otf_drive_memo (memo);
+    }
+}
+
+static int
+copy_otf_gstring (OTF_GlyphString *to, OTF_GlyphString *from)
+{
+  to->size = to->used = from->used;
+  to->glyphs = malloc (sizeof (OTF_Glyph) * (from->used > 0 ? from->used : 1));
+  if (! to->glyphs)
+    return -1;
+  memcpy (to->glyphs, from->glyphs, sizeof (OTF_Glyph) * from->used);
+  return 0;
+}
+
+/* Return the memo of driving OTF by SPEC on the glyphs between FROM
+   and TO of IN.  If there's no such memo yet, drive OTF to make it.
+   SCRIPT, LANGSYS, GSUB_FEATURES, and GPOS_FEATURES are what
+   ft_drive_otf () made from SPEC for libotf.  Return NULL on memory
+   shortage.  */
+
+static OTFDriveMemo *
+get_otf_drive_memo (OTF *otf, MFLTOtfSpec *spec, char *script,
+		    char *langsys, char *gsub_features, char *gpos_features,
+		    MFLTGlyphString *in, int from, int to)
+{
+  int len = to - from;
+  unsigned *input = alloca (sizeof (unsigned) * len * 2);
+  OTFDriveMemo *memo, **bucket;
+  OTF_GlyphString otf_gstring;
+  unsigned hash;
+  int gsub_len, gpos_len;
+  char *p;
+  int i;
+
+  for (i = 0; i < len; i++)
+    {
+      MGlyph *g = (MGlyph *) in->glyphs + (from + i);
+
+      input[i * 2] = g->g.c & 0x11FFFF;
+      input[i * 2 + 1] = g->g.code;
+    }
+  hash = otf_drive_memo_hash (otf, spec->script, spec->langsys,
+			      gsub_features, gpos_features, input, len);
+  bucket = otf_drive_memo_table + (hash % OTF_DRIVE_MEMO_BUCKETS);
+  for (memo = *bucket; memo; memo = memo->next)
+    if (otf_drive_memo_match (memo, hash, otf, spec->script, spec->langsys,
+			      gsub_features, gpos_features, input, len))
+      {
+	if (memo->prev_used)
+	  {
+	    memo->prev_used->next_used = memo->next_used;
+	    if (memo->next_used)
+	      memo->next_used->prev_used = memo->prev_used;
+	    else
+	      otf_drive_memo_tail = memo->prev_used;
+	    memo->prev_used = NULL;
+	    memo->next_used = otf_drive_memo_head;
+	    otf_drive_memo_head->prev_used = memo;
+	    otf_drive_memo_head = memo;
+	  }
+	return memo;
+      }
+
+  gsub_len = gsub_features ? strlen (gsub_features) + 1 : 0;
+  gpos_len = gpos_features ? strlen (gpos_features) + 1 : 0;
+  memo = calloc (1, (sizeof (OTFDriveMemo) + sizeof (unsigned) * len * 2
+		     + gsub_len + gpos_len));
+  if (! memo)
+    return NULL;
+  memo->hash = hash;
+  memo->otf = otf;
+  memo->script = spec->script;
+  memo->langsys = spec->langsys;
+  memo->len = len;
+  memo->input = (unsigned *) (memo + 1);
+  memcpy (memo->input, input, sizeof (unsigned) * len * 2);
+  p = (char *) (memo->input + len * 2);
+  if (gsub_features)
+    {
+      memo->gsub_features = p;
+      memcpy (p, gsub_features, gsub_len);
+      p += gsub_len;
+    }
+  if (gpos_features)
+    {
+      memo->gpos_features = p;
+      memcpy (p, gpos_features, gpos_len);
+    }
+
+  otf_gstring.size = otf_gstring.used = len;
+  otf_gstring.glyphs = (OTF_Glyph *) calloc (len, sizeof (OTF_Glyph));
+  if (! otf_gstring.glyphs)
+    {
+      free (memo);
+      return NULL;
+    }
+  for (i = 0; i < len; i++)
+    {
+      otf_gstring.glyphs[i].c = input[i * 2];
+      otf_gstring.glyphs[i].glyph_id = input[i * 2 + 1];
+    }
+  OTF_drive_gdef (otf, &otf_gstring);
+  if (gsub_features)
+    {
+      memo->gsub_result = OTF_drive_gsub_with_log (otf, &otf_gstring, script,
+						   langsys, gsub_features);
+      if (memo->gsub_result >= 0
+	  && copy_otf_gstring (&memo->gsub, &otf_gstring) < 0)
+	{
+	  free (otf_gstring.glyphs);
+	  free (memo);
+	  return NULL;
+	}
+    }
+  if (gpos_features && memo->gsub_result >= 0)
+    {
+      memo->gpos_result = OTF_drive_gpos_with_log (otf, &otf_gstring, script,
+						   langsys, gpos_features);
+      if (memo->gpos_result >= 0)
+	{
+	  memo->gpos = otf_gstring;
+	  otf_gstring.glyphs = NULL;
+	}
+    }
+  if (otf_gstring.glyphs)
+    free (otf_gstring.glyphs);
+
+  memo->next = *bucket;
+  *bucket = memo;
+  memo->next_used = otf_drive_memo_head;
+  if (otf_drive_memo_head)
+    otf_drive_memo_head->prev_used = memo;
+  else
+    otf_drive_memo_tail = memo;
+  otf_drive_memo_head = memo;
+  otf_drive_memo_glyphs += len;
+  while (otf_drive_memo_glyphs > OTF_DRIVE_MEMO_GLYPHS
+	 && otf_drive_memo_tail != memo)
+    free_otf_drive_memo (otf_drive_memo_tail);
+  return memo;
+}
+
 #define DEVICE_DELTA(table, size)				\
   (((size) >= (table).StartSize && (size) <= (table).EndSize)	\
    ? (table).DeltaValue[(size) - (table).StartSize] << 6	\
@@ -2279,6 +3196,7 @@ ft_drive_otf (MFLTFont *font, MFLTOtfSpec *spec,
   MGlyph *out_glyphs = out ? (MGlyph *) (out->glyphs) : NULL;
   OTF *otf;
   FT_Face face;
+  OTFDriveMemo *memo;
   OTF_GlyphString otf_gstring;
   OTF_Glyph *otfg;
   char script[5], *langsys = NULL;
@@ -2322,16 +3240,10 @@ ft_drive_otf (MFLTFont *font, MFLTOtfSpec *spec,
 	}
     }
 
-  otf_gstring.size = otf_gstring.used = len;
-  otf_gstring.glyphs = (OTF_Glyph *) malloc (sizeof (OTF_Glyph) * len);
-  memset (otf_gstring.glyphs, 0, sizeof (OTF_Glyph) * len);
-  for (i = 0; i < len; i++)
-    {
-      otf_gstring.glyphs[i].c = ((MGlyph *)in->glyphs)[from + i].g.c & 0x11FFFF;
-      otf_gstring.glyphs[i].glyph_id = ((MGlyph *)in->glyphs)[from + i].g.code;
-    }
-
-  OTF_drive_gdef (otf, &otf_gstring);
+  memo = get_otf_drive_memo (otf, spec, script, langsys,
+			     gsub_features, gpos_features, in, from, to);
+  if (! memo)
+    goto simple_copy;
   gidx = out ? out->used : from;
 
   if (gsub_features)
@@ -2339,9 +3251,9 @@ ft_drive_otf (MFLTFont *font, MFLTOtfSpec *spec,
       OTF_Feature *features;
       MGlyph *g;
 
-      if (OTF_drive_gsub_with_log (otf, &otf_gstring, script, langsys,
-				   gsub_features) < 0)
+      if (memo->gsub_result < 0)
 	goto simple_copy;
+      otf_gstring = memo->gsub;
       features = otf->gsub->FeatureList.Feature;
       if (out)
 	{
@@ -2417,9 +3329,9 @@ ft_drive_otf (MFLTFont *font, MFLTOtfSpec *spec,
       OTF_Feature *features;
       MGlyph *g;
 
-      if (OTF_drive_gpos_with_log (otf, &otf_gstring, script, langsys,
-				   gpos_features) < 0)
+      if (memo->gpos_result < 0)
 	return to;
+      otf_gstring = memo->gpos;
       features = otf->gpos->FeatureList.Feature;
       if (out)
 	{
@@ -2564,13 +3476,9 @@ ft_drive_otf (MFLTFont *font, MFLTOtfSpec *spec,
 	      }
 	}
     }
-
-  free (otf_gstring.glyphs);
   return to;
 
  simple_copy:
-  if (otf_gstring.glyphs)
-    free (otf_gstring.glyphs);
 #endif	/* HAVE_OTF */
   if (out)
     {
@@ -2790,6 +3698,9 @@ mfont__ft_fini ()
 	}
       M17N_OBJECT_UNREF (ft_font_list);
       ft_font_list = NULL;
+#ifdef HAVE_OTF
+      flush_otf_drive_memo (NULL);
+#endif	/* HAVE_OTF */
 
       if (ft_language_list)
 	{
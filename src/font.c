@@ -1452,6 +1452,177 @@ mdebug_dump_font_list (MFontList *font_list)
     }
 }
 
+/* Cache of glyph metrics of a realized font.  */
+
+typedef struct
+{
+  /* Glyph code, or MCHAR_INVALID_CODE if the slot is empty.  */
+  unsigned code;
+  int lbearing, rbearing, xadv, ascent, descent;
+} MFontMetric;
+
+struct MFontMetricCache
+{
+  M17NObject control;
+
+  /* If nonzero, ENTRIES is indexed directly by glyph code.
+     Otherwise, it is a hash table with open addressing.  */
+  int direct;
+
+  /* Number of elements of ENTRIES, and number of slots in use.  In a
+     hash table, SIZE is a power of 2.  */
+  int size, used;
+
+  /* Allocated on the first store.  */
+  MFontMetric *entries;
+};
+
+/* A font of at most this many glyphs gets a direct-indexed cache.  */
+#define MFONT_METRIC_DIRECT_MAX 0x1000
+
+/* Initial and maximum numbers of slots of a hash table.  */
+#define MFONT_METRIC_HASH_INIT 0x100
+#define MFONT_METRIC_HASH_MAX 0x10000
+
+#define MFONT_METRIC_HASH(code, size) \
+  (((code) * 2654435761U) & ((size) - 1))
+
+static void
+free_metric_cache (void *object)
+{
+  MFontMetricCache *cache = object;
+
+  if (cache->entries)
+    free (cache->entries);
+  free (cache);
+}
+
+static MFontMetric *
+alloc_metric_entries (int size)
+{
+  MFontMetric *entries = malloc (sizeof (MFontMetric) * size);
+  int i;
+
+  if (entries)
+    for (i = 0; i < size; i++)
+      entries[i].code = MCHAR_INVALID_CODE;
+  return entries;
+}
+
+/* Return a new cache of glyph metrics for a realized font of
+   NUM_GLYPHS glyphs.  NUM_GLYPHS is 0 if unknown.  */
+
+MFontMetricCache *
+mfont__metric_cache (int num_glyphs)
+{
+  MFontMetricCache *cache;
+
+  M17N_OBJECT (cache, free_metric_cache, MERROR_FONT);
+  if (num_glyphs > 0 && num_glyphs <= MFONT_METRIC_DIRECT_MAX)
+    {
+      cache->direct = 1;
+      cache->size = num_glyphs;
+    }
+  else
+    cache->size = MFONT_METRIC_HASH_INIT;
+  return cache;
+}
+
+static MFontMetric *
+find_metric_entry (MFontMetricCache *cache, unsigned code)
+{
+  MFontMetric *e;
+  int i;
+
+  if (cache->direct)
+    return (code < cache->size ? cache->entries + code : NULL);
+  for (i = MFONT_METRIC_HASH (code, cache->size);
+       (e = cache->entries + i)->code != MCHAR_INVALID_CODE;
+       i = (i + 1) & (cache->size - 1))
+    if (e->code == code)
+      break;
+  return e;
+}
+
+/* If the metrics of G are in the cache of RFONT, set them in G and
+   return 1.  Otherwise return 0.  */
+
+int
+mfont__lookup_metric (MRealizedFont *rfont, MGlyph *g)
+{
+  MFontMetricCache *cache = rfont->metric_cache;
+  MFontMetric *e;
+
+  if (! cache || ! cache->entries || g->g.code == MCHAR_INVALID_CODE)
+    return 0;
+  e = find_metric_entry (cache, g->g.code);
+  if (! e || e->code != g->g.code)
+    return 0;
+  g->g.lbearing = e->lbearing;
+  g->g.rbearing = e->rbearing;
+  g->g.xadv = e->xadv;
+  g->g.yadv = 0;
+  g->g.ascent = e->ascent;
+  g->g.descent = e->descent;
+  g->g.measured = 1;
+  return 1;
+}
+
+/* Store the metrics of the measured glyph G in the cache of RFONT.  */
+
+void
+mfont__store_metric (MRealizedFont *rfont, MGlyph *g)
+{
+  MFontMetricCache *cache = rfont->metric_cache;
+  MFontMetric *e;
+
+  if (! cache || g->g.code == MCHAR_INVALID_CODE)
+    return;
+  if (! cache->entries)
+    {
+      cache->entries = alloc_metric_entries (cache->size);
+      if (! cache->entries)
+	return;
+    }
+  if (! cache->direct && (cache->used + 1) * 2 > cache->size)
+    {
+      MFontMetric *old = cache->entries;
+      int old_size = cache->size, i;
+
+      if (cache->size < MFONT_METRIC_HASH_MAX)
+	cache->size *= 2;
+      cache->entries = alloc_metric_entries (cache->size);
+      if (! cache->entries)
+	{
+	  cache->entries = old;
+	  cache->size = old_size;
+	  return;
+	}
+      cache->used = 0;
+      /* If the table is already of the maximum size, just start
+	 over.  */
+      if (cache->size > old_size)
+	for (i = 0; i < old_size; i++)
+	  if (old[i].code != MCHAR_INVALID_CODE)
+	    {
+	      *find_metric_entry (cache, old[i].code) = old[i];
+	      cache->used++;
+	    }
+      free (old);
+    }
+  e = find_metric_entry (cache, g->g.code);
+  if (! e)
+    return;
+  if (! cache->direct && e->code == MCHAR_INVALID_CODE)
+    cache->used++;
+  e->code = g->g.code;
+  e->lbearing = g->g.lbearing;
+  e->rbearing = g->g.rbearing;
+  e->xadv = g->g.xadv;
+  e->ascent = g->g.ascent;
+  e->descent = g->g.descent;
+}
+
 void
 mfont__free_realized (MRealizedFont *rfont)
 {
@@ -1461,6 +1632,7 @@ mfont__free_realized (MRealizedFont *rfont)
     {
       next = rfont->next;
       M17N_OBJECT_UNREF (rfont->info);
+      M17N_OBJECT_UNREF (rfont->metric_cache);
       free (rfont);
       rfont = next;
     }
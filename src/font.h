@@ -68,6 +68,7 @@ enum MFontSpacing
 
 typedef struct MFontEncoding MFontEncoding;
 typedef struct MFontDriver MFontDriver;
+typedef struct MFontMetricCache MFontMetricCache;
 
 /** Information about a font.  This structure is used in three ways:
     FONT-OBJ, FONT-OPENED, and FONT-SPEC.  
@@ -169,6 +170,11 @@ struct MRealizedFont
   /* Pointer to the font structure.  */
   void *fontp;
 
+  /* Cache of glyph metrics set by MRealizedFont::driver->open, or
+     NULL if the driver doesn't cache them.  It is a managed
+     object.  */
+  MFontMetricCache *metric_cache;
+
   MRealizedFont *next;
 };
 
@@ -324,6 +330,12 @@ extern int mfont__ft_decode_otf (MGlyph *g);
 
 extern void mfont__free_realized (MRealizedFont *rfont);
 
+extern MFontMetricCache *mfont__metric_cache (int num_glyphs);
+
+extern int mfont__lookup_metric (MRealizedFont *rfont, MGlyph *g);
+
+extern void mfont__store_metric (MRealizedFont *rfont, MGlyph *g);
+
 extern int mfont__match_p (MFont *font, MFont *spec, int prop);
 
 extern int mfont__merge (MFont *dst, MFont *src, int error_on_conflict);
@@ -146,6 +146,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
 
 #include "config.h"
 
@@ -212,12 +213,34 @@ struct MIMMap
   /** List of deeper maps.  If NULL, this is a terminal map.  */
   MPlist *submaps;
 
+  /** Number of elements in SUBMAPS.  */
+  int nsubmaps;
+
+  /** Open-addressing hash table of SUBMAPS keyed by a key symbol, or
+      NULL if SUBMAPS is short enough to be searched linearly.  The
+      size of the table is TABLE_SIZE, which is a power of 2.  */
+  struct MIMMapEntry *table;
+  int table_size;
+
   /** List of actions to take when we leave the map successfully.  In
       a root map, the actions are executed only when none of submaps
       handle the current key.  */
   MPlist *branch_actions;
 };
 
+struct MIMMapEntry
+{
+  MSymbol key;
+  MIMMap *map;
+};
+
+/* A map having this many submaps or more gets a hash table.  */
+#define MIM_MAP_TABLE_THRESHOLD 8
+
+#define MIM_MAP_HASH(key, size)					\
+  (((((unsigned long) (key)) >> 4) ^ (((unsigned long) (key)) >> 12))	\
+   & ((size) - 1))
+
 typedef MPlist *(*MIMExternalFunc) (MPlist *plist);
 
 typedef struct
@@ -227,6 +250,13 @@ typedef struct
   MPlist *func_list;		/* function name vs (MIMExternalFunc *) */
 } MIMExternalModule;
 
+/* List of external modules ever loaded.  It is a plist of
+   MODULE-NAME vs (MIMExternalModule *) whose func_list contains all
+   functions resolved so far.  Modules are kept loaded until
+   minput__fini () so that reloading an input method doesn't have to
+   open them and resolve functions again.  */
+static MPlist *external_module_list;
+
 struct MIMState
 {
   M17NObject control;
@@ -269,13 +299,14 @@ static MInputMethodInfo *global_info;
 
 /* List of fallback input methods: well-formed plist of this form:
      ((im-lang1 im-name1) (im-lang2 im-name2) ...)
-   The elements are in reverse preference order.  */
+   The elements are in preference order.  */
 
 static MPlist *fallback_input_methods;
 
 static int update_global_info (void);
 static int update_custom_info (void);
 static MInputMethodInfo *get_im_info (MSymbol, MSymbol, MSymbol, MSymbol);
+static void clear_candidates_cache (void);
 
 
 /* Initialize fallback_input_methods.  Called by fully_initialize ()
@@ -301,7 +332,7 @@ prepare_fallback_input_methods ()
       plist = minput_parse_im_names (MPLIST_MTEXT (plist));
       MPLIST_DO (p, plist) 
 	if (MPLIST_KEY (p) == Mplist)
-	  mplist_push (fallback_input_methods, Mplist, MPLIST_VAL (p));
+	  mplist_add (fallback_input_methods, Mplist, MPLIST_VAL (p));
       M17N_OBJECT_UNREF (plist);
     }
 }
@@ -574,19 +605,42 @@ marker_code (MSymbol sym, int surrounding)
 }
 
 
+/* Return a plist of the form (VAR VALUE) for variable VAR of
+   IC_INFO, or NULL if VAR is not set.  If VAR is not yet set in
+   IC_INFO->vars, the initial value is copied from
+   IC_INFO->initial_vars that is shared with the other input contexts
+   of the same input method.  */
+
+static MPlist *
+lookup_variable (MInputContextInfo *ic_info, MSymbol var)
+{
+  MPlist *plist = mplist__assq (ic_info->vars, var);
+  MPlist *pl;
+
+  if (plist)
+    return MPLIST_PLIST (plist);
+  if (! ic_info->initial_vars
+      || ! (plist = mplist__assq (ic_info->initial_vars, var)))
+    return NULL;
+  plist = MPLIST_NEXT (MPLIST_PLIST (plist));
+  pl = mplist ();
+  mplist_push (ic_info->vars, Mplist, pl);
+  M17N_OBJECT_UNREF (pl);
+  mplist_add (pl, Msymbol, var);
+  mplist_add (pl, MPLIST_KEY (plist), MPLIST_VAL (plist));
+  return pl;
+}
+
 /* Return a plist containing an integer value of VAR.  The plist must
    not be UNREFed. */
 
 static MPlist *
 resolve_variable (MInputContextInfo *ic_info, MSymbol var)
 {
-  MPlist *plist = mplist__assq (ic_info->vars, var);
+  MPlist *plist = lookup_variable (ic_info, var);
 
   if (plist)
-    {
-      plist = MPLIST_PLIST (plist);
-      return MPLIST_NEXT (plist);
-    }
+    return MPLIST_NEXT (plist);
 
   plist = mplist ();
   mplist_push (ic_info->vars, Mplist, plist);
@@ -609,6 +663,37 @@ get_surrounding_text (MInputContext *ic, int len)
   return mt;
 }
 
+/* Get the surrounding text between FROM and TO (relative to the
+   cursor position) by the callback Minput_get_surrounding_window.
+   If the callback is not available, return NULL.  */
+
+static MText *
+get_surrounding_window (MInputContext *ic, int from, int to)
+{
+  MText *mt = NULL;
+
+  mplist_push (ic->plist, Minteger, (void *) to);
+  mplist_push (ic->plist, Minteger, (void *) from);
+  if (minput_callback (ic, Minput_get_surrounding_window) >= 0
+      && MPLIST_MTEXT_P (ic->plist))
+    mt = MPLIST_MTEXT (ic->plist);
+  mplist_pop (ic->plist);
+  mplist_pop (ic->plist);
+  return mt;
+}
+
+/* Forget the surrounding text got so far.  */
+
+static void
+clear_surrounding_text (MInputContext *ic)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+
+  M17N_OBJECT_UNREF (ic_info->preceding_text);
+  M17N_OBJECT_UNREF (ic_info->following_text);
+  ic_info->preceding_text = ic_info->following_text = NULL;
+}
+
 static void
 delete_surrounding_text (MInputContext *ic, int pos)
 {
@@ -641,6 +726,24 @@ get_preceding_char (MInputContext *ic, int pos)
       len = mtext_nchars (ic_info->preceding_text);
       if (pos <= len)
 	return mtext_ref_char (ic_info->preceding_text, len - pos);
+      /* Get only the missing part if possible.  */
+      mt = get_surrounding_window (ic, - pos, - len);
+      if (mt)
+	{
+	  if (mtext_nchars (mt) > 0)
+	    {
+	      MText *joined = mtext_cat (mtext_dup (mt),
+					 ic_info->preceding_text);
+
+	      M17N_OBJECT_UNREF (ic_info->preceding_text);
+	      ic_info->preceding_text = joined;
+	      len = mtext_nchars (joined);
+	    }
+	  M17N_OBJECT_UNREF (mt);
+	  if (pos > len)
+	    return -1;
+	  return mtext_ref_char (ic_info->preceding_text, len - pos);
+	}
     }
   mt = get_surrounding_text (ic, - pos);
   if (! mt)
@@ -675,6 +778,24 @@ get_following_char (MInputContext *ic, int pos)
       len = mtext_nchars (ic_info->following_text);
       if (pos < len)
 	return mtext_ref_char (ic_info->following_text, pos);
+      /* Get only the missing part if possible.  */
+      mt = get_surrounding_window (ic, len, pos + 1);
+      if (mt)
+	{
+	  if (mtext_nchars (mt) > 0)
+	    {
+	      MText *joined = mtext_cat (mtext_dup (ic_info->following_text),
+					 mt);
+
+	      M17N_OBJECT_UNREF (ic_info->following_text);
+	      ic_info->following_text = joined;
+	      len = mtext_nchars (joined);
+	    }
+	  M17N_OBJECT_UNREF (mt);
+	  if (pos >= len)
+	    return -1;
+	  return mtext_ref_char (ic_info->following_text, pos);
+	}
     }
   mt = get_surrounding_text (ic, pos + 1);
   if (! mt)
@@ -1051,6 +1172,81 @@ resolve_command (MPlist *cmds, MSymbol command)
   return plist;
 }
 
+/* Return a submap of MAP for KEY, or NULL if MAP has no such
+   submap.  */
+
+static MIMMap *
+lookup_submap (MIMMap *map, MSymbol key)
+{
+  struct MIMMapEntry *entry;
+  int i;
+
+  if (! map->submaps)
+    return NULL;
+  if (! map->table)
+    return (MIMMap *) mplist_get (map->submaps, key);
+  for (i = MIM_MAP_HASH (key, map->table_size);
+       (entry = map->table + i)->key;
+       i = (i + 1) & (map->table_size - 1))
+    if (entry->key == key)
+      return entry->map;
+  return NULL;
+}
+
+/* Record SUBMAP in MAP->table for KEY.  MAP->table must have a
+   room for it.  */
+
+static void
+map_table_put (MIMMap *map, MSymbol key, MIMMap *submap)
+{
+  int i;
+
+  for (i = MIM_MAP_HASH (key, map->table_size); map->table[i].key;
+       i = (i + 1) & (map->table_size - 1));
+  map->table[i].key = key;
+  map->table[i].map = submap;
+}
+
+/* Add SUBMAP to MAP as a submap for KEY.  Build or enlarge the hash
+   table of MAP if necessary so that the table is at most half full.
+   Return 0 on success, -1 on error.  On error, MAP is not changed
+   and the caller still owns SUBMAP.  */
+
+static int
+add_submap (MIMMap *map, MSymbol key, MIMMap *submap)
+{
+  int nsubmaps = map->nsubmaps + 1;
+  struct MIMMapEntry *table = NULL;
+  int size = map->table_size;
+
+  if (nsubmaps >= MIM_MAP_TABLE_THRESHOLD && nsubmaps * 2 > size)
+    {
+      size = size ? size * 2 : 32;
+      while (nsubmaps * 2 > size)
+	size *= 2;
+      MTABLE_CALLOC_SAFE (table, size);
+      if (! table)
+	MERROR (MERROR_IM, -1);
+    }
+  if (! map->submaps)
+    map->submaps = mplist ();
+  mplist_add (map->submaps, key, submap);
+  map->nsubmaps = nsubmaps;
+  if (table)
+    {
+      MPlist *plist;
+
+      free (map->table);
+      map->table = table;
+      map->table_size = size;
+      MPLIST_DO (plist, map->submaps)
+	map_table_put (map, MPLIST_KEY (plist), MPLIST_VAL (plist));
+    }
+  else if (map->table)
+    map_table_put (map, key, submap);
+  return 0;
+}
+
 /* Load a translation into MAP from PLIST.
    PLIST has this form:
       PLIST ::= ( KEYSEQ MAP-ACTION * )  */
@@ -1083,7 +1279,7 @@ load_translation (MIMMap *map, MPlist *keylist, MPlist *map_actions,
       len = MPLIST_LENGTH (elt);
       if (MFAILP (len > 0))
 	return -1;
-      keyseq = (MSymbol *) alloca (sizeof (int) * len);
+      keyseq = (MSymbol *) alloca (sizeof (MSymbol) * len);
       for (i = 0; i < len; i++, elt = MPLIST_NEXT (elt))
 	{
 	  if (MPLIST_INTEGER_P (elt))
@@ -1105,17 +1301,17 @@ load_translation (MIMMap *map, MPlist *keylist, MPlist *map_actions,
 
   for (i = 0; i < len; i++)
     {
-      MIMMap *deeper = NULL;
+      MIMMap *deeper = lookup_submap (map, keyseq[i]);
 
-      if (map->submaps)
-	deeper = mplist_get (map->submaps, keyseq[i]);
-      else
-	map->submaps = mplist ();
       if (! deeper)
 	{
 	  /* Fixme: It is better to make all deeper maps at once.  */
 	  MSTRUCT_CALLOC (deeper, MERROR_IM);
-	  mplist_put (map->submaps, keyseq[i], deeper);
+	  if (add_submap (map, keyseq[i], deeper) < 0)
+	    {
+	      free (deeper);
+	      return -1;
+	    }
 	}
       map = deeper;
     }
@@ -1244,6 +1440,38 @@ load_macros (MInputMethodInfo *im_info, MPlist *plist)
   return 0;
 }
 
+/* Return the module MODULE registered in external_module_list.  If
+   it is not yet registered, open it and register it.  On error,
+   return NULL.  */
+
+static MIMExternalModule *
+find_external_module (MSymbol module)
+{
+  MIMExternalModule *external;
+  char *module_file;
+  void *handle;
+
+  if (! external_module_list)
+    external_module_list = mplist ();
+  else if ((external = mplist_get (external_module_list, module)))
+    return external;
+
+  module_file = alloca (strlen (M17N_MODULE_DIR) + 1
+			+ strlen (MSYMBOL_NAME (module))
+			+ strlen (DLOPEN_SHLIB_EXT) + 1);
+  sprintf (module_file, "%s/%s%s",
+	   M17N_MODULE_DIR, MSYMBOL_NAME (module), DLOPEN_SHLIB_EXT);
+  handle = dlopen (module_file, RTLD_NOW);
+  if (MFAILP (handle))
+    return NULL;
+  MSTRUCT_MALLOC (external, MERROR_IM);
+  external->name = module;
+  external->handle = handle;
+  external->func_list = mplist ();
+  mplist_push (external_module_list, module, external);
+  return external;
+}
+
 /* Load an external module from PLIST, and return a pointer to
    MIMExternalModule.
 
@@ -1251,15 +1479,17 @@ load_macros (MInputMethodInfo *im_info, MPlist *plist)
       PLIST ::= ( MODULE-NAME FUNCTION * )
    IM_INFO->externals is a plist of MODULE-NAME vs (MIMExternalModule *).
 
+   The returned MIMExternalModule has only FUNCTIONs in its
+   func_list.  The module itself and the functions are shared through
+   external_module_list.
+
    On error, return NULL.  */
 
 static MIMExternalModule *
 load_external_module (MPlist *plist)
 {
-  void *handle;
   MSymbol module;
-  char *module_file;
-  MIMExternalModule *external;
+  MIMExternalModule *registered, *external;
   MPlist *func_list;
   void *func;
 
@@ -1267,46 +1497,72 @@ load_external_module (MPlist *plist)
     module = msymbol ((char *) MTEXT_DATA (MPLIST_MTEXT (plist)));
   else if (MPLIST_SYMBOL_P (plist))
     module = MPLIST_SYMBOL (plist);
-  module_file = alloca (strlen (M17N_MODULE_DIR) + 1
-			+ strlen (MSYMBOL_NAME (module))
-			+ strlen (DLOPEN_SHLIB_EXT) + 1);
-  sprintf (module_file, "%s/%s%s",
-	   M17N_MODULE_DIR, MSYMBOL_NAME (module), DLOPEN_SHLIB_EXT);
-
-  handle = dlopen (module_file, RTLD_NOW);
-  if (MFAILP (handle))
+  else
+    MERROR (MERROR_IM, NULL);
+  registered = find_external_module (module);
+  if (! registered)
     return NULL;
   func_list = mplist ();
   MPLIST_DO (plist, MPLIST_NEXT (plist))
     {
+      MSymbol name;
+
       if (! MPLIST_SYMBOL_P (plist))
 	MERROR_GOTO (MERROR_IM, err_label);
-      func = dlsym (handle, MSYMBOL_NAME (MPLIST_SYMBOL (plist)));
-      if (MFAILP (func))
-	goto err_label;
-      mplist_add (func_list, MPLIST_SYMBOL (plist), func);
+      name = MPLIST_SYMBOL (plist);
+      func = mplist_get_func (registered->func_list, name);
+      if (! func)
+	{
+	  func = dlsym (registered->handle, MSYMBOL_NAME (name));
+	  if (MFAILP (func))
+	    goto err_label;
+	  mplist_put_func (registered->func_list, name, func);
+	}
+      mplist_put_func (func_list, name, func);
     }
 
   MSTRUCT_MALLOC (external, MERROR_IM);
   external->name = module;
-  external->handle = handle;
+  external->handle = registered->handle;
   external->func_list = func_list;
   return external;
 
  err_label:
   M17N_OBJECT_UNREF (func_list);
-  dlclose (handle);
   return NULL;
 }
 
+/* Free EXTERNAL returned by load_external_module ().  The module
+   itself is kept open.  */
+
 static void
 unload_external_module (MIMExternalModule *external)
 {
-  dlclose (external->handle);
   M17N_OBJECT_UNREF (external->func_list);
   free (external);
 }
 
+/* Close all modules registered in external_module_list.  */
+
+static void
+free_external_module_list ()
+{
+  MPlist *plist;
+
+  if (! external_module_list)
+    return;
+  MPLIST_DO (plist, external_module_list)
+    {
+      MIMExternalModule *external = MPLIST_VAL (plist);
+
+      dlclose (external->handle);
+      M17N_OBJECT_UNREF (external->func_list);
+      free (external);
+    }
+  M17N_OBJECT_UNREF (external_module_list);
+  external_module_list = NULL;
+}
+
 static void
 free_map (MIMMap *map, int top)
 {
@@ -1320,6 +1576,7 @@ free_map (MIMMap *map, int top)
 	free_map ((MIMMap *) MPLIST_VAL (plist), 0);
       M17N_OBJECT_UNREF (map->submaps);
     }
+  free (map->table);
   M17N_OBJECT_UNREF (map->branch_actions);
   free (map);
 }
@@ -1409,7 +1666,10 @@ fini_im_info (MInputMethodInfo *im_info)
   M17N_OBJECT_UNREF (im_info->vars);
   M17N_OBJECT_UNREF (im_info->configured_vars);
   M17N_OBJECT_UNREF (im_info->bc_vars);
+  M17N_OBJECT_UNREF (im_info->initial_vars);
+  im_info->initial_vars = NULL;
   M17N_OBJECT_UNREF (im_info->description);
+  clear_candidates_cache ();
   M17N_OBJECT_UNREF (im_info->title);
   if (im_info->states)
     {
@@ -2280,6 +2540,10 @@ config_all_variables (MInputMethodInfo *im_info)
   MPlist *tail, *plist;
 
   M17N_OBJECT_UNREF (im_info->configured_vars);
+  /* Input contexts created from now on should see the new values.
+     The existing ones keep referring to the old list.  */
+  M17N_OBJECT_UNREF (im_info->initial_vars);
+  im_info->initial_vars = NULL;
 
   if (MPLIST_TAIL_P (im_info->vars)
       || ! im_info->mdb)
@@ -2481,6 +2745,137 @@ load_im_info (MPlist *plist, MInputMethodInfo *im_info)
 
 
 
+/* Merge the replacement of characters between FROM and TO of the
+   current text by LEN characters into CHANGE.  */
+
+static void
+merge_text_change (MIMTextChange *change, int from, int to, int len)
+{
+  int end;
+
+  if (change->from < 0)
+    {
+      change->from = from;
+      change->to = to;
+      change->len = len;
+      return;
+    }
+  /* END is the end of the changed region in the current text.  The
+     characters after it are the same as those after CHANGE->to in the
+     old text.  */
+  end = change->from + change->len;
+  if (to > end)
+    {
+      change->to += to - end;
+      end = to;
+    }
+  if (from < change->from)
+    change->from = from;
+  change->len = end - (to - from) + len - change->from;
+}
+
+/* Record that characters between FROM and TO of the preedit text of
+   IC are replaced by LEN characters.  */
+
+static void
+record_preedit_change (MInputContext *ic, int from, int to, int len)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+
+  merge_text_change (&ic_info->saved_change, from, to, len);
+  merge_text_change (&ic_info->notify_change, from, to, len);
+}
+
+/* Update IC_INFO->preedit_saved to the current preedit text of IC.
+   Only the changed region is copied.  */
+
+static void
+save_preedit (MInputContext *ic)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+  MIMTextChange *change = &ic_info->saved_change;
+
+  if (change->from < 0)
+    return;
+  mtext_del (ic_info->preedit_saved, change->from, change->to);
+  mtext_insert (ic_info->preedit_saved, change->from,
+		ic->preedit, change->from, change->from + change->len);
+  change->from = -1;
+}
+
+/* Restore the preedit text of IC from IC_INFO->preedit_saved.  Only
+   the changed region is copied.  */
+
+static void
+restore_preedit (MInputContext *ic)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+  MIMTextChange *change = &ic_info->saved_change;
+  int from = change->from, to = change->to, len = change->len;
+
+  if (from < 0)
+    return;
+  mtext_del (ic->preedit, from, from + len);
+  mtext_insert (ic->preedit, from, ic_info->preedit_saved, from, to);
+  merge_text_change (&ic_info->notify_change, from, from + len, to - from);
+  change->from = -1;
+}
+
+/* Called when IC->info was changed from OLD_INFO by pushing or
+   popping an input method.  As the preedit text is shared, take over
+   the change not yet notified.  */
+
+static void
+takeover_preedit_change (MInputContext *ic, MInputContextInfo *old_info)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+
+  ic_info->saved_change.from = 0;
+  ic_info->saved_change.to = mtext_nchars (ic_info->preedit_saved);
+  ic_info->saved_change.len = mtext_nchars (ic->preedit);
+  ic_info->notify_change = old_info->notify_change;
+  old_info->notify_change.from = -1;
+}
+
+/* Take over the surrounding text got so far and its revision from
+   OLD_INFO on pushing or popping an input method.  As the surrounding
+   text belongs to the client, not to an input method, it is valid
+   after the switch.  */
+
+static void
+takeover_surrounding_text (MInputContext *ic, MInputContextInfo *old_info)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+
+  clear_surrounding_text (ic);
+  ic_info->surrounding_revision = old_info->surrounding_revision;
+  ic_info->preceding_text = old_info->preceding_text;
+  ic_info->following_text = old_info->following_text;
+  old_info->surrounding_revision = -1;
+  old_info->preceding_text = old_info->following_text = NULL;
+}
+
+/* Notify the change of the preedit text of IC (if any) by the
+   callback Minput_preedit_update.  */
+
+static void
+notify_preedit_change (MInputContext *ic)
+{
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+  MIMTextChange *change = &ic_info->notify_change;
+
+  if (change->from < 0)
+    return;
+  mplist_push (ic->plist, Minteger, (void *) change->len);
+  mplist_push (ic->plist, Minteger, (void *) change->to);
+  mplist_push (ic->plist, Minteger, (void *) change->from);
+  minput_callback (ic, Minput_preedit_update);
+  mplist_pop (ic->plist);
+  mplist_pop (ic->plist);
+  mplist_pop (ic->plist);
+  change->from = -1;
+}
+
 static int take_action_list (MInputContext *ic, MPlist *action_list);
 static void preedit_commit (MInputContext *ic, int need_prefix);
 
@@ -2534,7 +2929,7 @@ shift_state (MInputContext *ic, MSymbol state_name)
       && orig_state)
     /* We have shifted to the initial state.  */
     preedit_commit (ic, 0);
-  mtext_cpy (ic_info->preedit_saved, ic->preedit);
+  save_preedit (ic);
   ic_info->state_pos = ic->cursor_pos;
   if (state != orig_state || state_name == Mnil)
     {
@@ -2648,6 +3043,7 @@ preedit_insert (MInputContext *ic, int pos, MText *mt, int c)
 	MDEBUG_PRINT1 ("(U+%04X)", c);
     }
   adjust_markers (ic, pos, pos, nchars);
+  record_preedit_change (ic, pos, pos, nchars);
   ic->preedit_changed = 1;
 }
 
@@ -2657,6 +3053,7 @@ preedit_delete (MInputContext *ic, int from, int to)
 {
   mtext_del (ic->preedit, from, to);
   adjust_markers (ic, from, to, 0);
+  record_preedit_change (ic, from, to, 0);
   ic->preedit_changed = 1;
 }
 
@@ -2677,6 +3074,7 @@ preedit_replace (MInputContext *ic, int from, int to, MText *mt, int c)
       ins = 1;
     }
   adjust_markers (ic, from, to, ins);
+  record_preedit_change (ic, from, to, ins);
   ic->preedit_changed = 1;
 }
 
@@ -2714,6 +3112,8 @@ preedit_commit (MInputContext *ic, int need_prefix)
 	  MDEBUG_PRINT (")");
 	}
 
+      merge_text_change (&ic_info->notify_change, 0, preedit_len, 0);
+      ic_info->saved_change.from = -1;
       mtext_reset (ic->preedit);
       mtext_reset (ic_info->preedit_saved);
       MPLIST_DO (p, ic_info->markers)
@@ -2926,22 +3326,96 @@ adjust_candidates (MPlist *plist, MCharset *charset)
   return plist;
 }
 
-/* The returned Plist must be UNREFed.  */
+/* Cache of candidate lists made by get_candidate_list ().  An entry
+   is valid if SOURCE is not NULL.  CANDIDATES is the result of
+   filtering SOURCE by CHARSET and grouping by COLUMN, and may be
+   NULL.  */
+
+#define CANDIDATES_CACHE_SIZE 64
+
+static struct
+{
+  MPlist *source;
+  int column;
+  MCharset *charset;
+  MPlist *candidates;
+} candidates_cache[CANDIDATES_CACHE_SIZE];
+
+static void
+clear_candidates_cache (void)
+{
+  int i;
+
+  for (i = 0; i < CANDIDATES_CACHE_SIZE; i++)
+    if (candidates_cache[i].source)
+      {
+	M17N_OBJECT_UNREF (candidates_cache[i].source);
+	M17N_OBJECT_UNREF (candidates_cache[i].candidates);
+	candidates_cache[i].source = candidates_cache[i].candidates = NULL;
+      }
+}
+
+static MPlist *make_candidate_list (MPlist *plist, MCharset *charset,
+				    int column);
+
+/* The returned Plist must be UNREFed, and must not be modified.  */
 
 static MPlist *
 get_candidate_list (MInputContextInfo *ic_info, MPlist *args)
 {
   MCharset *charset = get_select_charset (ic_info);
-  MPlist *plist;
+  MPlist *plist, *source;
   int column;
-  int i, len;
+  int i;
 
   plist = resolve_variable (ic_info, Mcandidates_group_size);
   column = MPLIST_INTEGER (plist);
 
-  plist = MPLIST_PLIST (args);
-  if (! plist)
+  source = MPLIST_PLIST (args);
+  if (! source)
     return NULL;
+  if (! charset && column == 0)
+    {
+      M17N_OBJECT_REF (source);
+      return source;
+    }
+
+  /* Filtering and grouping of candidates are done only once for the
+     same candidates, and the result is reused.  */
+  i = ((((unsigned long) source) >> 4) + column) % CANDIDATES_CACHE_SIZE;
+  if (candidates_cache[i].source == source
+      && candidates_cache[i].column == column
+      && candidates_cache[i].charset == charset)
+    plist = candidates_cache[i].candidates;
+  else
+    {
+      plist = make_candidate_list (source, charset, column);
+      if (candidates_cache[i].source)
+	{
+	  M17N_OBJECT_UNREF (candidates_cache[i].source);
+	  M17N_OBJECT_UNREF (candidates_cache[i].candidates);
+	}
+      candidates_cache[i].source = source;
+      M17N_OBJECT_REF (source);
+      candidates_cache[i].column = column;
+      candidates_cache[i].charset = charset;
+      /* The cache holds its own reference to PLIST.  */
+      candidates_cache[i].candidates = plist;
+    }
+  if (plist)
+    M17N_OBJECT_REF (plist);
+  return plist;
+}
+
+/* Return a list of candidates made from PLIST by filtering them by
+   CHARSET (if not NULL) and grouping them by COLUMN (if not zero).
+   The returned Plist must be UNREFed.  */
+
+static MPlist *
+make_candidate_list (MPlist *plist, MCharset *charset, int column)
+{
+  int i, len;
+
   if (charset)
     {
       plist = adjust_candidates (plist, charset);
@@ -3016,14 +3490,10 @@ get_candidate_list (MInputContextInfo *ic_info, MPlist *args)
 	}
       mplist_add (new, Mplist, this);
       M17N_OBJECT_UNREF (this);
-      mplist_set (plist, Mnil, NULL);
-      MPLIST_DO (tail, new)
-	{
-	  MPlist *elt = MPLIST_PLIST (tail);
-
-	  mplist_add (plist, Mplist, elt);
-	}
-      M17N_OBJECT_UNREF (new);
+      /* PLIST may be the source itself, which must not be
+	 modified.  */
+      M17N_OBJECT_UNREF (plist);
+      plist = new;
     }
 
   return plist;
@@ -3040,14 +3510,11 @@ regularize_action (MPlist *action_list, MInputContextInfo *ic_info)
   if (MPLIST_SYMBOL_P (action_list))
     {
       MSymbol var = MPLIST_SYMBOL (action_list);
-      MPlist *p;
+      MPlist *p = lookup_variable (ic_info, var);
 
-      MPLIST_DO (p, ic_info->vars)
-	if (MPLIST_SYMBOL (MPLIST_PLIST (p)) == var)
-	  break;
-      if (MPLIST_TAIL_P (p))
+      if (! p)
 	return NULL;
-      action = MPLIST_NEXT (MPLIST_PLIST (p));
+      action = MPLIST_NEXT (p);
       mplist_set (action_list, MPLIST_KEY (action), MPLIST_VAL (action));
     }
 
@@ -3389,19 +3856,33 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 	  result = 0;
 	  module = MPLIST_SYMBOL (args);
 	  args = MPLIST_NEXT (args);
-	  func_name = MPLIST_SYMBOL (args);
-
-	  if (im_info->externals)
+	  if (MPLIST_VAL_FUNC_P (args))
+	    /* Already resolved by the code below.  */
+	    func = (MIMExternalFunc) MPLIST_FUNC (args);
+	  else
 	    {
-	      MIMExternalModule *external
-		= (MIMExternalModule *) mplist_get (im_info->externals,
-						    module);
-	      if (external)
-		func = ((MIMExternalFunc)
-			mplist_get_func (external->func_list, func_name));
+	      func_name = MPLIST_SYMBOL (args);
+	      if (im_info->externals)
+		{
+		  MIMExternalModule *external
+		    = (MIMExternalModule *) mplist_get (im_info->externals,
+							module);
+		  if (external)
+		    func = ((MIMExternalFunc)
+			    mplist_get_func (external->func_list, func_name));
+		}
+	      if (! func)
+		continue;
+	      /* Remember the function in the action itself so that we
+		 don't have to look it up again.  The key is changed to
+		 the function name.  */
+	      if (func_name != Mnil && ! func_name->managing_key)
+		{
+		  MPLIST_KEY (args) = func_name;
+		  MPLIST_FUNC (args) = (M17NFunc) func;
+		  MPLIST_SET_VAL_FUNC_P (args);
+		}
 	    }
-	  if (! func)
-	    continue;
 	  func_args = mplist ();
 	  mplist_add (func_args, Mt, ic);
 	  MPLIST_DO (args, MPLIST_NEXT (args))
@@ -3438,6 +3919,9 @@ take_action_list (MInputContext *ic, MPlist *action_list)
 			? ic_info->used - 2
 			: integer_value (ic, args, 0));
 
+	  merge_text_change (&ic_info->notify_change,
+			     0, mtext_nchars (ic->preedit), 0);
+	  ic_info->saved_change.from = -1;
 	  mtext_reset (ic->preedit);
 	  mtext_reset (ic_info->preedit_saved);
 	  mtext_reset (ic->produced);
@@ -3611,7 +4095,7 @@ handle_key (MInputContext *ic)
 		     MSYMBOL_NAME (im_info->name),
 		     MSYMBOL_NAME (ic_info->state->name));
       result = take_action_list (ic, ic_info->state_hook);
-      mtext_cpy (ic_info->preedit_saved, ic->preedit);
+      save_preedit (ic);
       ic_info->state_pos = ic->cursor_pos;
       ic_info->state_hook = NULL;
       if (result != 0)
@@ -3628,12 +4112,12 @@ handle_key (MInputContext *ic)
 
   if (map->submaps)
     {
-      submap = mplist_get (map->submaps, key);
+      submap = lookup_submap (map, key);
       alias = key;
       while (! submap
 	     && (alias = msymbol_get (alias, M_key_alias))
 	     && alias != key)
-	submap = mplist_get (map->submaps, alias);
+	submap = lookup_submap (map, alias);
     }
 
   if (submap)
@@ -3642,7 +4126,7 @@ handle_key (MInputContext *ic)
 	MDEBUG_PRINT (" submap-found");
       else
 	MDEBUG_PRINT1 (" submap-found (by alias `%s')", MSYMBOL_NAME (alias));
-      mtext_cpy (ic->preedit, ic_info->preedit_saved);
+      restore_preedit (ic);
       ic->preedit_changed = 1;
       ic->cursor_pos = ic_info->state_pos;
       ic_info->key_head++;
@@ -3665,7 +4149,10 @@ handle_key (MInputContext *ic)
 	      char *name = msymbol_name (key);
 
 	      if (! name[0] || ! name[1])
-		mtext_ins_char (ic->preedit, ic->cursor_pos++, name[0], 1);
+		{
+		  record_preedit_change (ic, ic->cursor_pos, ic->cursor_pos, 1);
+		  mtext_ins_char (ic->preedit, ic->cursor_pos++, name[0], 1);
+		}
 	    }
 	}
 
@@ -3766,6 +4253,8 @@ pop_im (MInputContext *ic)
 		 MSYMBOL_NAME (im_info->name));
   ic->im->info = ic_info->stack->im_info;
   ic->info = ic_info->stack->ic_info;
+  takeover_preedit_change (ic, ic_info);
+  takeover_surrounding_text (ic, ic_info);
   /*ic_info = (MInputContextInfo *) ic->info;*/
   free (ic_info->stack);
   ic_info->stack = NULL;
@@ -3806,12 +4295,15 @@ push_im (MInputContext *ic, MInputContext *pushing)
   stack->im_info = (MInputMethodInfo *)ic->im->info;
   stack->ic_info = ic_info;
   M17N_OBJECT_UNREF (ic_info->pushing_or_switching);
+  ic_info->pushing_or_switching = NULL;
   ic->im->info = pushing->im->info;
   ic->info = pushing->info;
   ic->status = pushing->status;
   ic->status_changed = 1;
   ic_info = (MInputContextInfo *) ic->info;
   ic_info->stack = stack;
+  takeover_preedit_change (ic, stack->ic_info);
+  takeover_surrounding_text (ic, stack->ic_info);
   MDEBUG_PRINT2 ("\n  [IM:%s-%s] pushed", 
 		 MSYMBOL_NAME (pushing->im->language),
 		 MSYMBOL_NAME (pushing->im->name));
@@ -3830,29 +4322,37 @@ init_ic_info (MInputContext *ic)
   MLIST_INIT1 (ic_info, keys, 8);;
 
   ic_info->markers = mplist ();
+  ic_info->saved_change.from = ic_info->notify_change.from = -1;
 
-  ic_info->vars = mplist ();
   /* If this input method has its own setting of variables, record
-     those values in ic_info->vars.  */
-  if (im_info->configured_vars)
-    MPLIST_DO (plist, im_info->configured_vars)
-      {
-	MPlist *pl = MPLIST_PLIST (plist);
-	MSymbol name = MPLIST_SYMBOL (pl);
+     those values in im_info->initial_vars, which is shared by all
+     input contexts.  */
+  if (! im_info->initial_vars && im_info->configured_vars)
+    {
+      im_info->initial_vars = mplist ();
+      MPLIST_DO (plist, im_info->configured_vars)
+	{
+	  MPlist *pl = MPLIST_PLIST (plist);
+	  MSymbol name = MPLIST_SYMBOL (pl);
 
-	pl = MPLIST_NEXT (MPLIST_NEXT (MPLIST_NEXT (pl)));
-	if (MPLIST_KEY (pl) != Mt)
-	  {
-	    MPlist *p = mplist ();
+	  pl = MPLIST_NEXT (MPLIST_NEXT (MPLIST_NEXT (pl)));
+	  if (MPLIST_KEY (pl) != Mt)
+	    {
+	      MPlist *p = mplist ();
 
-	    mplist_push (ic_info->vars, Mplist, p);
-	    M17N_OBJECT_UNREF (p);
-	    mplist_add (p, Msymbol, name);
-	    mplist_add (p, MPLIST_KEY (pl), MPLIST_VAL (pl));
-	  }
-      }
+	      mplist_push (im_info->initial_vars, Mplist, p);
+	      M17N_OBJECT_UNREF (p);
+	      mplist_add (p, Msymbol, name);
+	      mplist_add (p, MPLIST_KEY (pl), MPLIST_VAL (pl));
+	    }
+	}
+    }
+  ic_info->initial_vars = im_info->initial_vars;
+  if (ic_info->initial_vars)
+    M17N_OBJECT_REF (ic_info->initial_vars);
+  ic_info->vars = mplist ();
   /* Remember the original values.  */
-  ic_info->vars_saved = mplist_copy (ic_info->vars);
+  ic_info->vars_saved = mplist ();
 
   /* If this input method uses external modules, initialize them.  */
   if (im_info->externals)
@@ -3873,34 +4373,129 @@ init_ic_info (MInputContext *ic)
     }
 
   ic_info->preedit_saved = mtext ();
+  ic_info->surrounding_revision = -1;
 
-  if (fallback_input_methods)
-    {
-      /* Record MInputContext of each fallback input method in
-	 ic_info->fallbacks in the preference order.  Note that the
-	 input methods in fallback_input_methods are in reverse
-	 preference order.  */
-      MPlist *fallbacks = fallback_input_methods;
-
-      /* To prevent this part being called recursively via
-	 create_ic_for_im below.  */
-      fallback_input_methods = NULL;
-      ic_info->fallbacks = mplist ();
-      MPLIST_DO (plist, fallbacks)
-	{
-	  MInputContext *fallback_ic
-	    = create_ic_for_im (MPLIST_PLIST (plist), ic->im);
-	  if (fallback_ic)
-	    mplist_push (ic_info->fallbacks, Mt, fallback_ic);
-	}
-      fallback_input_methods = fallbacks;
-    }
+  /* Input contexts of fallback input methods are created on demand
+     by check_fallback ().  */
 
   /* Remember the tick of this input method to know when to
      re-initialize ic_info.  */
   ic_info->tick = im_info->tick;
 }
 
+/* Asynchronous results of external functions.  */
+
+/* Record written to async_pipe by minput_async_complete ().  It is
+   small enough to be written atomically.  */
+
+typedef struct
+{
+  int token;
+  MPlist *actions;
+} MIMAsyncResult;
+
+/* Pipe to pass MIMAsyncResult records to minput_async_dispatch ().  */
+static int async_pipe[2] = { -1, -1 };
+
+/* The last token returned by minput_async_begin ().  */
+static int async_last_token;
+
+/* Input context waiting for an asynchronous result.  This is not in
+   MInputContextInfo because push_im () and pop_im () change
+   IC->info.  */
+
+typedef struct
+{
+  MInputContext *ic;
+  /* Token of the result.  */
+  int token;
+  /* Number of keys filtered by IC since minput_async_begin () was
+     called.  The result is discarded unless this is zero.  */
+  int keys;
+} MIMAsyncWait;
+
+/* List of MIMAsyncWait.  */
+static MPlist *async_ic_list;
+
+/* Return the element of async_ic_list for IC, or NULL if IC is not
+   waiting.  */
+
+static MPlist *
+find_async_wait (MInputContext *ic)
+{
+  MPlist *plist;
+
+  if (async_ic_list)
+    MPLIST_DO (plist, async_ic_list)
+      if (((MIMAsyncWait *) MPLIST_VAL (plist))->ic == ic)
+	return plist;
+  return NULL;
+}
+
+static int
+open_async_pipe ()
+{
+  if (async_pipe[0] < 0)
+    {
+      if (pipe (async_pipe) < 0)
+	MERROR (MERROR_IM, -1);
+      fcntl (async_pipe[0], F_SETFL,
+	     fcntl (async_pipe[0], F_GETFL) | O_NONBLOCK);
+      fcntl (async_pipe[0], F_SETFD, FD_CLOEXEC);
+      fcntl (async_pipe[1], F_SETFD, FD_CLOEXEC);
+    }
+  return 0;
+}
+
+/* Read a result from async_pipe into RESULT.  Return 1 if read, 0 if
+   there's nothing to read.  */
+
+static int
+read_async_result (MIMAsyncResult *result)
+{
+  if (async_pipe[0] < 0)
+    return 0;
+  return (read (async_pipe[0], result, sizeof *result) == sizeof *result);
+}
+
+static void
+close_async_pipe ()
+{
+  MIMAsyncResult result;
+
+  while (read_async_result (&result))
+    M17N_OBJECT_UNREF (result.actions);
+  if (async_pipe[0] >= 0)
+    {
+      close (async_pipe[0]);
+      close (async_pipe[1]);
+      async_pipe[0] = async_pipe[1] = -1;
+    }
+  if (async_ic_list)
+    {
+      MPlist *plist;
+
+      MPLIST_DO (plist, async_ic_list)
+	free (MPLIST_VAL (plist));
+      M17N_OBJECT_UNREF (async_ic_list);
+    }
+}
+
+/* Stop waiting for an asynchronous result for IC.  A result arrived
+   later is discarded.  */
+
+static void
+cancel_async (MInputContext *ic)
+{
+  MPlist *plist = find_async_wait (ic);
+
+  if (plist)
+    {
+      free (MPLIST_VAL (plist));
+      mplist_pop (plist);
+    }
+}
+
 /* Finalize IC->ic_info.  */
 
 static void
@@ -3943,11 +4538,13 @@ fini_ic_info (MInputContext *ic)
       M17N_OBJECT_UNREF (func_args);
     }
 
+  cancel_async (ic);
   MLIST_FREE1 (ic_info, keys);
   M17N_OBJECT_UNREF (ic_info->preedit_saved);
   M17N_OBJECT_UNREF (ic_info->markers);
   M17N_OBJECT_UNREF (ic_info->vars);
   M17N_OBJECT_UNREF (ic_info->vars_saved);
+  M17N_OBJECT_UNREF (ic_info->initial_vars);
   M17N_OBJECT_UNREF (ic_info->preceding_text);
   M17N_OBJECT_UNREF (ic_info->following_text);
   M17N_OBJECT_UNREF (ic_info->pushing_or_switching);
@@ -3966,6 +4563,8 @@ re_init_ic (MInputContext *ic, int reload)
   int status_changed, preedit_changed, cursor_pos_changed, candidates_changed;
   /* Remember these now.  They are cleared by fini_ic_info ().  */
   MIMInputStack *stack = ic_info->stack;
+  MIMTextChange notify_change;
+  int surrounding_revision = ic_info->surrounding_revision;
 
   status_changed = ic_info->state != (MIMState *) MPLIST_VAL (im_info->states);
   preedit_changed = mtext_nchars (ic->preedit) > 0;
@@ -3991,7 +4590,12 @@ re_init_ic (MInputContext *ic, int reload)
   if (mtext_nchars (ic->produced) > 0)
     mtext_reset (ic->produced);
   if (mtext_nchars (ic->preedit) > 0)
-    mtext_reset (ic->preedit);
+    {
+      merge_text_change (&ic_info->notify_change,
+			 0, mtext_nchars (ic->preedit), 0);
+      mtext_reset (ic->preedit);
+    }
+  notify_change = ic_info->notify_change;
   ic->cursor_pos = 0;
   M17N_OBJECT_UNREF (ic->plist);
   ic->plist = mplist ();
@@ -4013,6 +4617,8 @@ re_init_ic (MInputContext *ic, int reload)
   init_ic_info (ic);
   /* Restore them now.  */
   ic_info->stack = stack;
+  ic_info->notify_change = notify_change;
+  ic_info->surrounding_revision = surrounding_revision;
   shift_state (ic, Mnil);
 
   ic->status_changed = status_changed;
@@ -4029,6 +4635,7 @@ reset_ic (MInputContext *ic, MSymbol ignore)
 		 MSYMBOL_NAME (im_info->language),
 		 MSYMBOL_NAME (im_info->name));
   re_init_ic (ic, 0);
+  notify_preedit_change (ic);
 }
 
 static int
@@ -4125,29 +4732,62 @@ check_reload (MInputContext *ic, MSymbol key)
   return 1;
 }
 
+/* Return an input context of a fallback input method that can handle
+   KEY, or NULL if there's no such input method.  The input context is
+   created when it is required first, and is recorded in
+   IC->info->fallbacks.  */
+
 static MInputContext *
 check_fallback (MInputContext *ic, MSymbol key)
 {
   MInputContextInfo *ic_info = ic->info;
-  MPlist *plist;
+  MPlist *plist, *pl;
 
-  MPLIST_DO (plist, ic_info->fallbacks)
+  if (! fallback_input_methods)
+    return NULL;
+  MPLIST_DO (plist, fallback_input_methods)
     {
+      MPlist *lang_name = MPLIST_PLIST (plist);
+      MSymbol language = MPLIST_SYMBOL (lang_name);
+      MSymbol name = MPLIST_SYMBOL (MPLIST_NEXT (lang_name));
       MSymbol alias = key;
-      MInputContext *this_ic = (MInputContext *) MPLIST_VAL (plist);
-      MInputMethodInfo *this_im_info = (MInputMethodInfo * )this_ic->im->info;
-      MIMMap *map = ((MIMState *) MPLIST_VAL (this_im_info->states))->map;
+      MInputMethodInfo *this_im_info;
+      MInputContext *this_ic;
+      MIMMap *map;
       MIMMap *submap;
       
+      if (language == ic->im->language && name == ic->im->name)
+	continue;
+      this_im_info = get_im_info (language, name, Mnil, Mnil);
+      if (! this_im_info || ! this_im_info->states
+	  || MPLIST_TAIL_P (this_im_info->states))
+	continue;
+      map = ((MIMState *) MPLIST_VAL (this_im_info->states))->map;
       if (! map->submaps)
 	continue;
-      submap = mplist_get (map->submaps, key);
+      submap = lookup_submap (map, key);
       while (! submap
 	     && (alias = msymbol_get (alias, M_key_alias))
 	     && alias != key)
-	submap = mplist_get (map->submaps, alias);
-      if (submap)
-	return this_ic;
+	submap = lookup_submap (map, alias);
+      if (! submap)
+	continue;
+
+      if (ic_info->fallbacks)
+	MPLIST_DO (pl, ic_info->fallbacks)
+	  {
+	    this_ic = MPLIST_VAL (pl);
+	    if (this_ic->im->language == language
+		&& this_ic->im->name == name)
+	      return this_ic;
+	  }
+      this_ic = create_ic_for_im (lang_name, ic->im);
+      if (! this_ic)
+	continue;
+      if (! ic_info->fallbacks)
+	ic_info->fallbacks = mplist ();
+      mplist_push (ic_info->fallbacks, Mt, this_ic);
+      return this_ic;
     }
   return NULL;
 }
@@ -4159,6 +4799,42 @@ check_fallback (MInputContext *ic, MSymbol key)
 
     Ignore ARG.  */
 
+/* Set the candidate members of IC from the preedit text, and update
+   IC->candidates_changed by comparing them with CANDIDATE_LIST,
+   CANDIDATE_INDEX, and CANDIDATE_SHOW, the values before the change
+   of the preedit text.  */
+
+static void
+update_candidates (MInputContext *ic, MPlist *candidate_list,
+		   int candidate_index, int candidate_show)
+{
+  MTextProperty *prop;
+
+  if (ic->candidate_list)
+    {
+      M17N_OBJECT_UNREF (ic->candidate_list);
+      ic->candidate_list = NULL;
+    }
+  if (ic->cursor_pos > 0
+      && (prop = mtext_get_property (ic->preedit, ic->cursor_pos - 1,
+				     Mcandidate_list)))
+    {
+      ic->candidate_list = mtext_property_value (prop);
+      M17N_OBJECT_REF (ic->candidate_list);
+      ic->candidate_index
+	= (int) mtext_get_prop (ic->preedit, ic->cursor_pos - 1,
+				Mcandidate_index);
+      ic->candidate_from = mtext_property_start (prop);
+      ic->candidate_to = mtext_property_end (prop);
+    }
+  if (candidate_list != ic->candidate_list)
+    ic->candidates_changed |= MINPUT_CANDIDATES_LIST_CHANGED;
+  if (candidate_index != ic->candidate_index)
+    ic->candidates_changed |= MINPUT_CANDIDATES_INDEX_CHANGED;
+  if (candidate_show != ic->candidate_show)
+    ic->candidates_changed |= MINPUT_CANDIDATES_SHOW_CHANGED;    
+}
+
 static int
 filter (MInputContext *ic, MSymbol key, void *arg)
 {
@@ -4184,42 +4860,29 @@ filter (MInputContext *ic, MSymbol key, void *arg)
   mtext_reset (ic->produced);
   ic->status_changed = ic->preedit_changed = ic->candidates_changed = 0;
   MLIST_APPEND1 (ic_info, keys, key, MERROR_IM);
+  if (async_ic_list)
+    {
+      /* A result asked for before this key is now out of date.  */
+      MPlist *plist = find_async_wait (ic);
+
+      if (plist)
+	((MIMAsyncWait *) MPLIST_VAL (plist))->keys++;
+    }
  repeat:
-  M17N_OBJECT_UNREF (ic_info->preceding_text);
-  M17N_OBJECT_UNREF (ic_info->following_text);
-  ic_info->preceding_text = ic_info->following_text = NULL;
+  /* Unless the front end tells the revision of the document, we
+     can't know whether the surrounding text got before is still
+     valid.  */
+  if (ic_info->surrounding_revision < 0)
+    clear_surrounding_text (ic);
   ic_info->key_unhandled = 0;
 
   do {
     MPlist *candidate_list = ic->candidate_list;
     int candidate_index = ic->candidate_index;
     int candidate_show = ic->candidate_show;
-    MTextProperty *prop;
 
     result = handle_key (ic);
-    if (ic->candidate_list)
-      {
-	M17N_OBJECT_UNREF (ic->candidate_list);
-	ic->candidate_list = NULL;
-      }
-    if (ic->cursor_pos > 0
-	&& (prop = mtext_get_property (ic->preedit, ic->cursor_pos - 1,
-				       Mcandidate_list)))
-      {
-	ic->candidate_list = mtext_property_value (prop);
-	M17N_OBJECT_REF (ic->candidate_list);
-	ic->candidate_index
-	  = (int) mtext_get_prop (ic->preedit, ic->cursor_pos - 1,
-				  Mcandidate_index);
-	ic->candidate_from = mtext_property_start (prop);
-	ic->candidate_to = mtext_property_end (prop);
-      }
-    if (candidate_list != ic->candidate_list)
-      ic->candidates_changed |= MINPUT_CANDIDATES_LIST_CHANGED;
-    if (candidate_index != ic->candidate_index)
-      ic->candidates_changed |= MINPUT_CANDIDATES_INDEX_CHANGED;
-    if (candidate_show != ic->candidate_show)
-      ic->candidates_changed |= MINPUT_CANDIDATES_SHOW_CHANGED;    
+    update_candidates (ic, candidate_list, candidate_index, candidate_show);
 
     if (count++ == 100)
       {
@@ -4317,7 +4980,8 @@ filter (MInputContext *ic, MSymbol key, void *arg)
 	  if (ic_info)
 	    {
 	      im_info = ic->im->info;
-	      goto repeat;
+	      if (ic_info->key_head < ic_info->used)
+		goto repeat;
 	    }
 	}
       else			/* (result == 1) switch */
@@ -4325,9 +4989,48 @@ filter (MInputContext *ic, MSymbol key, void *arg)
 	}
     }
 
+  /* The produced text will change the document.  */
+  if (mtext_nchars (ic->produced) > 0)
+    clear_surrounding_text (ic);
+  notify_preedit_change (ic);
   return (! ic_info->key_unhandled && mtext_nchars (ic->produced) == 0);
 }
 
+/* Take ACTIONS, an asynchronous result of an external function, in
+   IC as if they were returned by the function synchronously.  */
+
+static void
+take_async_result (MInputContext *ic, MPlist *actions)
+{
+  MInputMethodInfo *im_info = (MInputMethodInfo *) ic->im->info;
+  MInputContextInfo *ic_info = (MInputContextInfo *) ic->info;
+  MPlist *candidate_list = ic->candidate_list;
+  int candidate_index = ic->candidate_index;
+  int candidate_show = ic->candidate_show;
+
+  mtext_reset (ic->produced);
+  ic->status_changed = ic->preedit_changed = ic->candidates_changed = 0;
+  if (ic_info->surrounding_revision < 0)
+    clear_surrounding_text (ic);
+  take_action_list (ic, actions);
+  update_candidates (ic, candidate_list, candidate_index, candidate_show);
+  /* As in filter (), commit the preedit text at the root of the
+     initial state.  */
+  if (ic_info->map == ((MIMState *) MPLIST_VAL (im_info->states))->map)
+    preedit_commit (ic, 1);
+  if (mtext_nchars (ic->produced) > 0)
+    {
+      mtext_put_prop (ic->produced, 0, mtext_nchars (ic->produced),
+		      Mlanguage, ic->im->language);
+      clear_surrounding_text (ic);
+    }
+  MDEBUG_PRINT3 ("\n  [IM:%s-%s] (async result) [%s]",
+		 MSYMBOL_NAME (im_info->language),
+		 MSYMBOL_NAME (im_info->name),
+		 MSYMBOL_NAME (ic_info->state->name));
+  notify_preedit_change (ic);
+}
+
 
 /** Return 1 if the last event or key was not handled, otherwise
     return 0.
@@ -4423,6 +5126,7 @@ minput__init ()
   Minput_preedit_start = msymbol ("input-preedit-start");
   Minput_preedit_done = msymbol ("input-preedit-done");
   Minput_preedit_draw = msymbol ("input-preedit-draw");
+  Minput_preedit_update = msymbol ("input-preedit-update");
   Minput_status_start = msymbol ("input-status-start");
   Minput_status_done = msymbol ("input-status-done");
   Minput_status_draw = msymbol ("input-status-draw");
@@ -4436,6 +5140,8 @@ minput__init ()
   Minput_toggle = msymbol ("input-toggle");
   Minput_reset = msymbol ("input-reset");
   Minput_get_surrounding_text = msymbol ("input-get-surrounding-text");
+  Minput_get_surrounding_window
+    = msymbol ("input-get-surrounding-window");
   Minput_delete_surrounding_text = msymbol ("input-delete-surrounding-text");
   Mcustomized = msymbol ("customized");
   Mconfigured = msymbol ("configured");
@@ -4468,6 +5174,9 @@ minput__fini ()
 	free_im_list (im_config_list);
       M17N_OBJECT_UNREF (load_im_info_keys);
       M17N_OBJECT_UNREF (fallback_input_methods);
+      clear_candidates_cache ();
+      free_external_module_list ();
+      close_async_pipe ();
     }
 
   M17N_OBJECT_UNREF (minput_default_driver.callback_list);
@@ -4536,12 +5245,38 @@ MSymbol Minput_method;
     function should return without changing the first element of
     #MInputContext::plist.
 
+    @b Minput_get_surrounding_window: When a callback function
+    assigned for this command is called, the first two elements of
+    #MInputContext::plist have key #Minteger, and the values FROM and
+    TO (FROM < TO) specify the characters to retrieve by positions
+    relative to the current cursor position.  For instance, -3 and -1
+    mean the third and second characters preceding the cursor, and 2
+    and 4 mean the third and fourth characters following the cursor.
+    The callback function must set the key of the first element to
+    #Mtext and the value to the retrieved M-text in the same way as
+    the case of Minput_get_surrounding_text.  If a part of the
+    specified range is outside of the text, the M-text should contain
+    only the remaining part.  The input method uses this command, if
+    available, to get only the characters it doesn't have yet.
+
     @b Minput_delete_surrounding_text: When a callback function assigned
     for this command is called, the first element of
     #MInputContext::plist has key #Minteger and the value specifies
     which portion of the surrounding text should be deleted in the
     same way as the case of Minput_get_surrounding_text.  The callback
     function must delete the specified text.  It should not alter
+    #MInputContext::plist.
+
+    @b Minput_preedit_update: When a callback function assigned for
+    this command is called, the first three elements of
+    #MInputContext::plist have key #Minteger, and the values FROM, TO,
+    and LEN tell that the characters between FROM and TO of the
+    preedit text at the time of the previous call of this callback
+    function have been replaced by LEN characters from FROM of the
+    current preedit text (#MInputContext::preedit).  By applying the
+    change, an application can update the preedit text without
+    drawing the whole text.  This command is called before
+    @b Minput_preedit_draw.  The callback function should not alter
     #MInputContext::plist.  */ 
 /***ja
     ϥ᥽åɥɥ饤ФΥХåؿˤ @c COMMAND 
@@ -4566,15 +5301,38 @@ MSymbol Minput_method;
     饦ǥ󥰥ƥȤݡȤƤʤСХå
      #MInputContext::plist ǤѹƤϤʤʤ
 
+    Minput_get_surrounding_window: Υޥɤ˳Ƥ줿
+    ХåؿƤФ줿ݤˤϡ#MInputContext::plist κǽǤ
+    Ȥ#Minteger Ȥꡢ FROM  TO (FROM < TO) ϼä
+    ʸ򸽺ߤΥ֤а֤ǻꤹ롣Ȥ -3
+     -1 ϥԤ뻰ܤܤʸ2  4 ϥ
+    ³ܤȻܤʸ̣롣Хåؿ
+    Minput_get_surrounding_text ξƱͤˡǤΥ
+    #Mtext ˡͤ M-text ꤷʤƤϤʤʤꤵ
+    ϰϤΰƥȤγˤ硢M-text ϻĤʬΤߤޤ
+    Ф褤ϥ᥽åɤϡΥޥɤѲǽǤСޤä
+    ʤʸä뤿ˤѤ롣
+
     Minput_delete_surrounding_text: Υޥɤ˳Ƥ줿
     ХåؿƤФ줿ݤˤϡ#MInputContext::plist Ǥϡ
     Ȥ#Minteger ȤꡢͤϺ٤饦ǥ󥰥ƥȤ
     Minput_get_surrounding_text ƱͤΤǻꤹ롣Хå
     ؿϻꤵ줿ƥȤʤФʤʤޤ
-    #MInputContext::plist ѤƤϤʤʤ  */ 
+    #MInputContext::plist ѤƤϤʤʤ
+
+    Minput_preedit_update: Υޥɤ˳Ƥ줿Хå
+    ƤФ줿ݤˤϡ#MInputContext::plist κǽλǤϥȤ
+    #Minteger Ȥꡢ FROM, TO, LEN ϡ󤳤ΥХå
+    ؿƤФ줿 preedit ƥȤ FROM  TO ޤǤʸ
+    ߤ preedit ƥ (#MInputContext::preedit)  FROM Ϥ
+     LEN ʸ֤줿Ȥ򼨤ץꥱϤѹ
+    ŬѤ뤳ȤǡƥΤ褻 preedit ƥȤ򹹿
+    Ǥ롣Υޥɤ @b Minput_preedit_draw ˸ƤФ롣
+    Хåؿ #MInputContext::plist ѤƤϤʤʤ  */ 
 MSymbol Minput_preedit_start;
 MSymbol Minput_preedit_done;
 MSymbol Minput_preedit_draw;
+MSymbol Minput_preedit_update;
 MSymbol Minput_status_start;
 MSymbol Minput_status_done;
 MSymbol Minput_status_draw;
@@ -4585,6 +5343,7 @@ MSymbol Minput_set_spot;
 MSymbol Minput_toggle;
 MSymbol Minput_reset;
 MSymbol Minput_get_surrounding_text;
+MSymbol Minput_get_surrounding_window;
 MSymbol Minput_delete_surrounding_text;
 /*** @} */
 
@@ -5038,6 +5797,333 @@ minput_lookup (MInputContext *ic, MSymbol key, void *arg, MText *mt)
 }
 /*=*/
 
+/***en
+    @brief Filter a sequence of input keys.
+
+    The minput_filter_batch () function filters the $NKEYS input keys
+    in the array $KEYS by the input context $IC in order, and
+    concatenates the texts produced by the input method to M-text
+    $MT.  It has the same effect as calling minput_filter () and
+    minput_lookup () for each key, but the callback functions for
+    drawing the preedit text, status, and candidates are called only
+    once after all the keys are processed, and only if they are
+    changed by one of the keys.  The final preedit text and candidates
+    are found in $IC as usual.
+
+    This function is useful for replaying recorded keys or for
+    converting a typed string without an interactive front end.
+
+    @return
+    This function returns the number of keys that were not handled by
+    the input method.  */
+
+/***ja
+    @brief ϥե륿.
+
+    ؿ minput_filter_batch ()  $KEYS  $NKEYS Ĥϥ
+    ϥƥ $IC ˤäƽ˥ե륿ϥ᥽åɤˤ
+    줿ƥȤ M-text $MT Ϣ뤹롣ƥˤĤ
+    minput_filter ()  minput_lookup () Ƥ֤ΤƱ̤Ĥ
+    preedit ƥȡơ褹륳Хåؿϡ
+    ƤΥˡ줫ΥˤäƤ餬ѹ줿
+    ˤΤ߰٤ƤФ롣ǽŪ preedit ƥȤȸ̤̾
+    $IC ˤ롣
+
+    δؿϡϿ줿ꡢŪʥեȥɤʤ
+    Ϥ줿ʸѴͭѤǤ롣
+
+    @return
+    δؿϡϥ᥽åɤˤäƽʤäο֤  */
+
+int
+minput_filter_batch (MInputContext *ic, MSymbol *keys, int nkeys, MText *mt)
+{
+  int status_changed = 0, preedit_changed = 0, candidates_changed = 0;
+  int unhandled = 0;
+  int i;
+
+  if (! ic
+      || ! ic->active)
+    return nkeys;
+
+  for (i = 0; i < nkeys; i++)
+    {
+      if ((*ic->im->driver.filter) (ic, keys[i], NULL) == 0
+	  && (*ic->im->driver.lookup) (ic, keys[i], NULL, mt) < 0)
+	unhandled++;
+      status_changed |= ic->status_changed;
+      preedit_changed |= ic->preedit_changed;
+      candidates_changed |= ic->candidates_changed;
+    }
+  ic->status_changed = status_changed;
+  ic->preedit_changed = preedit_changed;
+  ic->candidates_changed = candidates_changed;
+
+  if (ic->im->driver.callback_list)
+    {
+      if (ic->preedit_changed)
+	minput_callback (ic, Minput_preedit_draw);
+      if (ic->status_changed)
+	minput_callback (ic, Minput_status_draw);
+      if (ic->candidates_changed)
+	minput_callback (ic, Minput_candidates_draw);
+    }
+
+  return unhandled;
+}
+/*=*/
+
+/***en
+    @brief Start waiting for an asynchronous result.
+
+    The minput_async_begin () function is called by a function of an
+    external module (see @ref mdbIM) that can't return its result
+    immediately, for instance because it asks a conversion server.
+    The function returns no actions (or an empty list), and later
+    passes the actions to minput_async_complete () with the token
+    returned by this function.  They are then taken by the input
+    context $IC when the front end calls minput_async_dispatch ().
+
+    If $IC is already waiting for another result, that result is
+    discarded when it arrives.  So is the result if $IC filters
+    another key before the result is taken.
+
+    @return
+    If the operation was successful, this function returns a positive
+    token.  Otherwise it returns -1.  */
+
+/***ja
+    @brief Ʊη̤Ԥ򳫻Ϥ.
+
+    ؿ minput_async_begin () ϡѴФؤ䤤碌ʤɤΤ
+    ˷̤¨¤֤ʤ⥸塼 (@ref mdbIM ) δؿ
+    ƤФ롣δؿϥ֤ (뤤϶ΥꥹȤ֤)
+    Ǥδؿ֤ȡȤȤ˥
+    minput_async_complete () ϤΥϡեȥ
+    ɤ minput_async_dispatch () ƤȤϥƥ $IC
+    ˼ޤ롣
+
+    $IC Ǥ̤η̤ԤäƤ硢η̤˼ΤƤ롣
+    ̤ޤ $IC ̤Υե륿⡢η
+    ̤ϼΤƤ롣
+
+    @return
+    СδؿΥȡ֤Ǥʤ -1
+    ֤  */
+
+int
+minput_async_begin (MInputContext *ic)
+{
+  MPlist *plist;
+  MIMAsyncWait *wait;
+
+  if (! ic)
+    MERROR (MERROR_IM, -1);
+  if (open_async_pipe () < 0)
+    return -1;
+  plist = find_async_wait (ic);
+  if (plist)
+    wait = MPLIST_VAL (plist);
+  else
+    {
+      MSTRUCT_CALLOC (wait, MERROR_IM);
+      wait->ic = ic;
+      if (! async_ic_list)
+	async_ic_list = mplist ();
+      mplist_push (async_ic_list, Mt, wait);
+    }
+  if (++async_last_token <= 0)
+    async_last_token = 1;
+  wait->token = async_last_token;
+  wait->keys = 0;
+  return async_last_token;
+}
+
+/*=*/
+
+/***en
+    @brief Pass an asynchronous result.
+
+    The minput_async_complete () function passes $ACTIONS, a list of
+    actions of the same form as the return value of a function of an
+    external module, as the result for $TOKEN returned by
+    minput_async_begin ().  $ACTIONS may be @c NULL, which means that
+    there's nothing to do.
+
+    Unlike the other functions of the m17n library, this function can
+    be called from any thread.  But $ACTIONS must be made (by mplist
+    (), msymbol (), mtext (), etc.) in the thread using the library,
+    because those functions are not thread-safe.  A module querying a
+    server in another thread should, for instance, make the possible
+    $ACTIONS in advance, or get the reply back to the thread using the
+    library before calling this function.
+
+    If the operation was successful, the reference to $ACTIONS is
+    taken over by the library, so the caller must not touch $ACTIONS
+    after calling this function.  Otherwise, the caller still owns the
+    reference.
+
+    @return
+    If the operation was successful, this function returns 0.
+    Otherwise it returns -1.  */
+
+/***ja
+    @brief Ʊη̤Ϥ.
+
+    ؿ minput_async_complete () ϡ⥸塼δؿ֤ͤ
+    ƱΥΥꥹ $ACTIONS minput_async_begin () 
+    ֤ȡ $TOKEN Ф̤ȤϤ$ACTIONS  @c NULL
+    Ǥ褯ξϲ⤷ʤȤ̣롣
+
+    m17n 饤֥¾δؿȰۤʤꡢδؿϤɤΥåɤƤ
+    Ǥ褤 mplist (), msymbol (), mtext () ʤɤϥåɥ
+    դǤʤΤǡ$ACTIONS ϥ饤֥ȤåɤǺʤФ
+    ʤȤ̤ΥåɤǥФ䤤碌⥸塼ϡ
+     $ACTIONS äƺäƤδؿƤ˱
+    ֥ȤåɤᤵʤФʤʤ
+
+     $ACTIONS ؤλȤϥ饤֥˰ѤΤǡ
+    ƤӽФ¦ϤδؿƤ $ACTIONS ˿ƤϤʤʤ
+    硢ȤϸƤӽФ¦˻Ĥ롣
+
+    @return
+    Сδؿ 0 ֤Ǥʤ -1 ֤  */
+
+int
+minput_async_complete (int token, MPlist *actions)
+{
+  MIMAsyncResult result;
+
+  result.token = token;
+  result.actions = actions;
+  if (token <= 0 || async_pipe[1] < 0
+      || write (async_pipe[1], &result, sizeof result) != sizeof result)
+    MERROR (MERROR_IM, -1);
+  return 0;
+}
+
+/*=*/
+
+/***en
+    @brief Get a file descriptor to watch asynchronous results.
+
+    The minput_async_fd () function returns a file descriptor that
+    becomes readable when an asynchronous result is passed by
+    minput_async_complete ().  A front end can watch it in its event
+    loop and call minput_async_dispatch () when it becomes readable.
+    The caller must not read from or close the file descriptor.
+
+    @return
+    If the operation was successful, this function returns a file
+    descriptor.  Otherwise it returns -1.  */
+
+/***ja
+    @brief Ʊη̤ƻ뤹ե뵭һҤ.
+
+    ؿ minput_async_fd () ϡminput_async_complete () ˤäƱ
+    η̤Ϥ줿Ȥɤ߽Фǽˤʤե뵭һҤ֤
+    ȥɤϥ٥ȥ롼פǤƻ뤷ɤ߽Фǽˤʤä
+    minput_async_dispatch () Ƥ٤Ф褤ƤӽФ¦ϤΥե뵭
+    һҤɤ߽ФꡢĤꤷƤϤʤʤ
+
+    @return
+    Сδؿϥե뵭һҤ֤Ǥʤ
+    -1 ֤  */
+
+int
+minput_async_fd (void)
+{
+  return (open_async_pipe () < 0 ? -1 : async_pipe[0]);
+}
+
+/*=*/
+
+/***en
+    @brief Take asynchronous results.
+
+    The minput_async_dispatch () function makes the input contexts
+    take all the asynchronous results passed by
+    minput_async_complete () so far.  For each input context that
+    took a result, the callback functions for drawing the preedit
+    text, status, and candidates are called as by minput_filter () if
+    they are changed.  A text produced by the result can be got by
+    minput_lookup () with @c Mnil as the key.
+
+    Results for input contexts already destroyed, no longer waiting
+    for them, or having filtered another key after asking for them
+    are discarded.
+
+    @return
+    This function returns the number of results taken.  */
+
+/***ja
+    @brief Ʊη̤.
+
+    ؿ minput_async_dispatch () ϡޤǤ
+    minput_async_complete () ˤäϤ줿ƤƱη̤
+    ƥȤ˼ޤ롣̤ϥƥȤˤ
+    ơpreedit ƥȡơ褹륳Хåؿ
+    餬ѹƤ minput_filter () Ʊͤ˸ƤФ롣
+    ̤ˤä줿ƥȤϡ @c Mnil Ȥ
+    minput_lookup () 롣
+
+    Ǥ˴줿ϥƥȡϤ̤ԤäƤʤϥ
+    ƥȡ̤᤿̤Υե륿ϥƥȤ
+    Ф̤ϼΤƤ롣
+
+    @return
+    δؿϼ̤ο֤  */
+
+int
+minput_async_dispatch (void)
+{
+  MIMAsyncResult result;
+  int count = 0;
+
+  while (read_async_result (&result))
+    {
+      MInputContext *ic = NULL;
+      MPlist *plist;
+
+      int keys = 0;
+
+      if (async_ic_list)
+	MPLIST_DO (plist, async_ic_list)
+	  {
+	    MIMAsyncWait *wait = MPLIST_VAL (plist);
+
+	    if (wait->token == result.token)
+	      {
+		ic = wait->ic;
+		keys = wait->keys;
+		break;
+	      }
+	  }
+      if (ic)
+	{
+	  cancel_async (ic);
+	  if (result.actions && ic->active && keys == 0)
+	    {
+	      take_async_result (ic, result.actions);
+	      if (ic->im->driver.callback_list)
+		{
+		  if (ic->preedit_changed)
+		    minput_callback (ic, Minput_preedit_draw);
+		  if (ic->status_changed)
+		    minput_callback (ic, Minput_status_draw);
+		  if (ic->candidates_changed)
+		    minput_callback (ic, Minput_candidates_draw);
+		}
+	    }
+	  if (keys == 0)
+	    count++;
+	}
+      M17N_OBJECT_UNREF (result.actions);
+    }
+  return count;
+}
+/*=*/
+
 /***en
     @brief Set the spot of the input context.
 
@@ -5146,6 +6232,52 @@ minput_reset_ic (MInputContext *ic)
 
 /*=*/
 
+/***en
+    @brief Tell the revision of the surrounding text.
+
+    The minput_set_surrounding_revision () function tells the input
+    context $IC that the document containing the surrounding text is
+    at revision $REVISION.  A front end should call it with a new
+    revision whenever the document or the cursor position in it is
+    changed by something other than the input method.
+
+    Once this function is called with a non-negative $REVISION, the
+    surrounding text got through the callback functions is kept and
+    reused by $IC until the revision is changed or the input method
+    produces a text.  Otherwise, it is discarded on each call of
+    minput_filter ().  A negative $REVISION restores that behavior.  */
+
+/***ja
+    @brief 饦ǥ󥰥ƥȤΥӥ.
+
+    ؿ minput_set_surrounding_revision () ϡ饦ǥ󥰥ƥ
+    Ȥޤʸ񤬥ӥ $REVISION Ǥ뤳Ȥϥƥ
+    $IC 롣եȥɤϡϥ᥽åɰʳˤäʸ񤢤뤤
+    ϤΥ֤ѹ뤿ӤˡӥǤ
+    Ƥ֤٤Ǥ롣
+
+    δؿ $REVISION ǰٸƤФȡХåؿˤ
+    Ƽ줿饦ǥ󥰥ƥȤϡӥѤ뤫ϥ
+    åɤƥȤޤ $IC ˤäݻ졢Ѥ롣
+    ǤʤС minput_filter () Ƥ֤Ӥ˼ΤƤ롣
+     $REVISION Ϥο񤤤᤹  */
+
+void
+minput_set_surrounding_revision (MInputContext *ic, int revision)
+{
+  MInputContextInfo *ic_info;
+
+  if (ic->im->language == Mnil)
+    /* Not an m17n input method.  */
+    return;
+  ic_info = (MInputContextInfo *) ic->info;
+  if (revision < 0 || revision != ic_info->surrounding_revision)
+    clear_surrounding_text (ic);
+  ic_info->surrounding_revision = revision < 0 ? -1 : revision;
+}
+
+/*=*/
+
 /***en
     @brief Get title and icon filename of an input method.
 
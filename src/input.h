@@ -31,6 +31,11 @@ struct _MInputMethodInfo
   MSymbol language, name, extra;
   MPlist *cmds, *configured_cmds, *bc_cmds;
   MPlist *vars, *configured_vars, *bc_vars;
+  /* Initial values of variables for input contexts in this form:
+       ((NAME VALUE) ...)
+     Built from configured_vars when an input context is created
+     first, and shared by all input contexts.  */
+  MPlist *initial_vars;
   MText *description;
   MText *title;
   MPlist *maps;
@@ -46,6 +51,15 @@ typedef struct MIMMap MIMMap;
 
 typedef struct MIMInputStack MIMInputStack;
 
+/** Change of a preedit text: characters between FROM and TO of the
+    old text are replaced by LEN characters from FROM of the new text.
+    FROM is negative if nothing has changed.  */
+
+typedef struct
+{
+  int from, to, len;
+} MIMTextChange;
+
 typedef struct
 {
   /** The current state.  */
@@ -76,16 +90,32 @@ typedef struct
   /** The insertion position when shifted to the current state.  */
   int state_pos;
 
+  /** Change of the preedit text from preedit_saved.  */
+  MIMTextChange saved_change;
+
+  /** Change of the preedit text not yet notified by the callback
+      Minput_preedit_update.  */
+  MIMTextChange notify_change;
+
   /** List of markers.  */
   MPlist *markers;
 
-  /** List of variables. */
+  /** List of variables set in this context.  Variables not listed
+      here have the values in initial_vars.  */
   MPlist *vars;
 
+  /** Initial values of variables.  Shared with the other input
+      contexts of the same input method.  */
+  MPlist *initial_vars;
+
   MPlist *vars_saved;
 
   MText *preceding_text, *following_text;
 
+  /** Revision of the document set by minput_set_surrounding_revision
+      (), or -1 if not set.  */
+  int surrounding_revision;
+
   int key_unhandled;
 
   /** Used by minput_win_driver (input-win.c).  */
@@ -1180,6 +1180,7 @@ xft_open (MFrame *frame, MFont *font, MFont *spec, MRealizedFont *rfont)
   rfont->font = font;
   rfont->driver = &xft_driver;
   rfont->info = rfont_xft;
+  rfont->metric_cache = mfont__metric_cache (ft_face->num_glyphs);
   rfont->ascent = ascent;
   rfont->descent = descent;
   rfont->max_advance = max_advance;
@@ -1202,7 +1203,7 @@ xft_find_metric (MRealizedFont *rfont, MGlyphString *gstring,
   MGlyph *g = MGLYPH (from), *gend = MGLYPH (to);
 
   for (; g != gend; g++)
-    if (! g->g.measured)
+    if (! g->g.measured && ! mfont__lookup_metric (rfont, g))
       {
 	if (g->g.code == MCHAR_INVALID_CODE)
 	  {
@@ -1225,6 +1226,7 @@ xft_find_metric (MRealizedFont *rfont, MGlyphString *gstring,
 	  }
 	g->g.yadv = 0;
 	g->g.measured = 1;
+	mfont__store_metric (rfont, g);
       }
 }
 
@@ -253,6 +253,26 @@ static MSymbol Mgenerator, Mend;
 static MPlist *flt_list;
 static int flt_min_coverage, flt_max_coverage;
 
+/* Index of FLTs by characters.  The value for a character is a
+   NULL-terminated array of the FLTs whose coverage contains the
+   character, in the order of flt_list.  Configured FLTs are not
+   included.  */
+static MCharTable *flt_index;
+static MFLT ***flt_index_candidates;
+static int flt_index_used;
+
+/* Memory of the FLTs found by mflt_find () for a font.  */
+typedef struct
+{
+  MSymbol font_id;
+  MFLT **candidates;
+  MFLT *flt;
+} FLTFindMemo;
+
+#define FLT_FIND_MEMO_SIZE 256
+
+static FLTFindMemo flt_find_memo[FLT_FIND_MEMO_SIZE];
+
 enum GlyphInfoMask
 {
   CategoryCodeMask = 0x7F,
@@ -286,17 +306,94 @@ enum GlyphInfoMask
 #define GET_MEASURED(g) ((g)->measured)
 #define SET_MEASURED(g, flag) ((g)->measured = (flag))
 
-#define GINIT(gstring, n)					\
-  do {								\
-    if (! (gstring)->glyph_size)				\
-      (gstring)->glyph_size = sizeof (MFLTGlyph);		\
-    (gstring)->glyphs = alloca ((gstring)->glyph_size * (n));	\
-    (gstring)->allocated = (n);					\
-    (gstring)->used = 0;					\
-  } while (0)
+/* Scratch buffers for working glyph strings and arrays used while
+   running an FLT.  They are kept across calls of mflt_run () so that
+   a long run of characters doesn't exhaust the stack and the memory
+   is not allocated each time.  They only grow, and are freed by
+   m17n_fini_flt ().  */
+
+enum FLTScratchIndex
+  {
+    /* Glyphs of the output of a stage.  */
+    FLT_SCRATCH_OUT,
+    /* Glyphs of the alternate glyph string used by run_stages ().  */
+    FLT_SCRATCH_BUF,
+    /* FontLayoutContext.encoded.  */
+    FLT_SCRATCH_ENCODED,
+    /* Adjustments given to the drive_otf callback.  */
+    FLT_SCRATCH_ADJUSTMENT,
+    /* Indices of glyphs covering each character.  */
+    FLT_SCRATCH_INDICES,
+    /* Key of the layout cache, and a copy of the input glyphs.  */
+    FLT_SCRATCH_CACHE_KEY,
+    FLT_SCRATCH_CACHE_IN,
+    /* Copy of the glyphs replaced by a cached result.  */
+    FLT_SCRATCH_REPLAY,
+    FLT_SCRATCH_MAX
+  };
+
+typedef struct
+{
+  void *data;
+  int size;
+} FLTScratch;
+
+static FLTScratch flt_scratch[FLT_SCRATCH_MAX];
+
+/* Make the Ith scratch buffer at least SIZE bytes long while keeping
+   its contents, and return it.  Return NULL on memory shortage.  */
+
+static void *
+get_flt_scratch (int i, int size)
+{
+  FLTScratch *scratch = flt_scratch + i;
+
+  if (size < 0)
+    return NULL;
+  if (! scratch->data || scratch->size < size)
+    {
+      int new_size = scratch->size > 0 ? scratch->size * 2 : 256;
+      void *data;
+
+      if (new_size < size)
+	new_size = size;
+      data = realloc (scratch->data, new_size);
+      if (! data)
+	return NULL;
+      scratch->data = data;
+      scratch->size = new_size;
+    }
+  return scratch->data;
+}
+
+static void
+free_flt_scratch (void)
+{
+  int i;
+
+  for (i = 0; i < FLT_SCRATCH_MAX; i++)
+    {
+      free (flt_scratch[i].data);
+      flt_scratch[i].data = NULL;
+      flt_scratch[i].size = 0;
+    }
+}
 
-#define GALLOCA (gstring)	\
-  ((MFLTGlyph *) alloca ((gstring)->glyph_size))
+/* Make GSTRING an empty glyph string of at least N glyphs in the Ith
+   scratch buffer.  Return 0 on success, -1 on memory shortage.  */
+
+static int
+GINIT (MFLTGlyphString *gstring, int i, int n)
+{
+  if (! gstring->glyph_size)
+    gstring->glyph_size = sizeof (MFLTGlyph);
+  gstring->glyphs = get_flt_scratch (i, gstring->glyph_size * n);
+  if (! gstring->glyphs)
+    return -1;
+  gstring->allocated = flt_scratch[i].size / gstring->glyph_size;
+  gstring->used = 0;
+  return 0;
+}
 
 #define GREF(gstring, idx)	\
   ((MFLTGlyph *) ((char *) ((gstring)->glyphs) + (gstring)->glyph_size * (idx)))
@@ -318,8 +415,9 @@ enum GlyphInfoMask
   do {						\
     MFLTGlyphString *src = (ctx)->in;		\
     MFLTGlyphString *tgt = (ctx)->out;		\
-    if (tgt->allocated <= tgt->used)		\
-      return -2;				\
+    if (tgt->allocated <= tgt->used		\
+	&& grow_out ((ctx), 1) < 0)		\
+      return -1;				\
     GCPY (src, (idx), 1, tgt, tgt->used);	\
     tgt->used++;				\
   } while (0)
@@ -427,15 +525,70 @@ typedef struct
   int *cmd_ids;
 } FontLayoutCmdRule;
 
+/* Deterministic automaton matching the regular expressions of the
+   rules in a cond command all at once.  */
+
+typedef struct
+{
+  /* Number of commands in the cond command.  */
+  int n_alts;
+
+  /* Number of states.  The state 0 is the dead state and the state 1
+     is the initial state.  */
+  int n_states;
+
+  /* Number of classes of input bytes.  */
+  int n_classes;
+
+  /* Class of each input byte.  */
+  unsigned char class[256];
+
+  /* Transition table of N_STATES * N_CLASSES elements.  */
+  unsigned short *trans;
+
+  /* Bit vectors of the commands whose regular expression matches
+     when each state is reached, and when the input ends at the
+     state.  Each vector is ALT_BYTES long.  */
+  unsigned char *accept, *accept_end;
+  int alt_bytes;
+} FontLayoutDFA;
+
+/* Trie of the character sequences of SEQ commands.  */
+
+typedef struct
+{
+  /* Index of the first SEQ command whose sequence ends at this node,
+     or -1.  */
+  int idx;
+
+  /* Number of children, and characters and nodes of the children
+     sorted by the characters.  */
+  int n_children;
+  int *codes, *children;
+} FontLayoutSeqNode;
+
+typedef struct
+{
+  int used, size;
+  /* The first element is the root.  */
+  FontLayoutSeqNode *nodes;
+} FontLayoutSeqTrie;
+
 typedef struct
 {
   /* Beginning and end indices of series of SEQ commands.  */
   int seq_beg, seq_end;
   /* Range of the first character appears in the above series.  */
   int seq_from, seq_to;
+  /* Trie of the above series, or NULL.  */
+  FontLayoutSeqTrie *seq_trie;
 
   int n_cmds;
   int *cmd_ids;
+
+  /* Automaton for the rules of regular expression in CMD_IDS, or
+     NULL.  */
+  FontLayoutDFA *dfa;
 } FontLayoutCmdCond;
 
 enum FontLayoutCmdType
@@ -471,8 +624,29 @@ typedef struct
   /* Non-null if the table must be re-configured by OTF specs included
      in the definition.  */
   MPlist *definition;
+  /* If non-NULL, CODES[C - MIN_CHAR] is the category code of the
+     character C in TABLE.  The other characters have no category.  */
+  char *codes;
+  int min_char, max_char;
 } FontLayoutCategory;
 
+/* Return the category code of the character C in CATEGORY.  */
+
+#define CATEGORY_CODE(category, c)					\
+  ((category)->codes							\
+   ? ((c) >= (category)->min_char && (c) <= (category)->max_char	\
+      ? (category)->codes[(c) - (category)->min_char] : 0)		\
+   : (int) mchartable_lookup ((category)->table, (c)))
+
+/* Return the category code of the glyph G in CATEGORY.  */
+
+#define GLYPH_CATEGORY_CODE(category, g)			\
+  (GET_ENCODED (g)						\
+   ? ((g)->c > 0 ? CATEGORY_CODE ((category), (g)->c) : 1)	\
+   : (g)->code							\
+   ? CATEGORY_CODE ((category), (g)->code)			\
+   : ' ')
+
 typedef struct 
 {
   FontLayoutCategory *category;
@@ -522,6 +696,45 @@ static unsigned int gen_otf_tag (char *p, int shift);
       PLIST ::= ( FROM-CODE TO-CODE ? CATEGORY-CHAR ) *
 */
 
+/* Maximum number of characters that the array of category codes of a
+   category table covers.  */
+#define CATEGORY_CODES_MAX 0x10000
+
+static void
+set_category_code (int from, int to, void *val, void *arg)
+{
+  FontLayoutCategory *category = arg;
+
+  memset (category->codes + (from - category->min_char), (int) val,
+	  to - from + 1);
+}
+
+/* Make the array of category codes of CATEGORY from its table so that
+   the category of a character is found without looking up the table.
+   This must be called again when the table is modified.  */
+
+static void
+make_category_codes (FontLayoutCategory *category)
+{
+  int from, to;
+
+  free (category->codes);
+  category->codes = NULL;
+  mchartable_range (category->table, &from, &to);
+  if (from < 0)
+    from = 0, to = -1;
+  if (to - from + 1 > CATEGORY_CODES_MAX)
+    return;
+  category->codes = calloc (to - from + 2, 1);
+  if (! category->codes)
+    return;
+  category->min_char = from;
+  category->max_char = to;
+  if (from <= to)
+    mchartable_map (category->table, (void *) 0, set_category_code,
+		    category);
+}
+
 static FontLayoutCategory *
 load_category_table (MPlist *plist, MFLTFont *font)
 {
@@ -590,6 +803,10 @@ load_category_table (MPlist *plist, MFLTFont *font)
 	      if (! isalnum (category_code))
 		MERROR_GOTO (MERROR_FLT, end);
 	      apply_otf_feature (font, &spec, from, to, table, category_code);
+	      if (spec.features[0])
+		free (spec.features[0]);
+	      if (spec.features[1])
+		free (spec.features[1]);
 	    }
 	  else
 	    need_otf = 1;
@@ -613,6 +830,7 @@ load_category_table (MPlist *plist, MFLTFont *font)
  end:
   category = calloc (1, sizeof (FontLayoutCategory));
   category->table = table;
+  make_category_codes (category);
   if (need_otf)
     {
       category->definition = plist;
@@ -665,6 +883,7 @@ unref_category_table (FontLayoutCategory *category)
 	  free (category->feature_table.tag);
 	  free (category->feature_table.code);
 	}
+      free (category->codes);
       free (category);
     }
 }
@@ -959,164 +1178,878 @@ get_combining_command (MSymbol sym)
 }
 
 
-/* Load a command from PLIST into STAGE, and return that
-   identification number.  If ID is not INVALID_CMD_ID, that means we
-   are loading a top level command or a macro.  In that case, use ID
-   as the identification number of the command.  Otherwise, generate a
-   new id number for the command.  MACROS is a list of raw macros.  */
+static void
+free_seq_trie (FontLayoutSeqTrie *trie)
+{
+  int i;
+
+  for (i = 0; i < trie->used; i++)
+    {
+      free (trie->nodes[i].codes);
+      free (trie->nodes[i].children);
+    }
+  free (trie->nodes);
+  free (trie);
+}
+
+/* Return the child of the node NODE of TRIE for the character C.  If
+   there's no such child and CREATE is nonzero, create it.  Return -1
+   if there's no such child, or the creation fails.  */
 
 static int
-load_command (FontLayoutStage *stage, MPlist *plist,
-	      MPlist *macros, int id)
+seq_trie_child (FontLayoutSeqTrie *trie, int node, int c, int create)
 {
-  int i;
-  int result;
+  FontLayoutSeqNode *n = trie->nodes + node;
+  int lo = 0, hi = n->n_children;
+  int *codes, *children;
 
-  if (MPLIST_INTEGER_P (plist))
+  while (lo < hi)
     {
-      int code = MPLIST_INTEGER (plist);
+      int mid = (lo + hi) / 2;
 
-      if (code < 0)
-	MERROR (MERROR_DRAW, INVALID_CMD_ID);
-      return code;
+      if (n->codes[mid] == c)
+	return n->children[mid];
+      if (n->codes[mid] < c)
+	lo = mid + 1;
+      else
+	hi = mid;
     }
-  else if (MPLIST_PLIST_P (plist))
+  if (! create)
+    return -1;
+  if (trie->used == trie->size)
     {
-      /* PLIST ::= ( cond ... ) | ( STRING ... ) | ( INTEGER ... )
- 	           | ( ( INTEGER INTEGER ) ... )
-		   | ( ( range INTEGER INTEGER ) ... )
-	           | ( ( SYMBOL STRING ) ... )
-		   | ( ( font-facilty [ INTEGER ] ) ... )
-		   | ( ( font-facilty OTF-SPEC ) ... )  */
-      MPlist *elt = MPLIST_PLIST (plist);
-      int len = MPLIST_LENGTH (elt) - 1;
-      FontLayoutCmd *cmd;
+      FontLayoutSeqNode *nodes = realloc (trie->nodes,
+					  (sizeof (FontLayoutSeqNode)
+					   * trie->size * 2));
 
-      if (id == INVALID_CMD_ID)
+      if (! nodes)
+	return -1;
+      trie->nodes = nodes;
+      trie->size *= 2;
+      n = trie->nodes + node;
+    }
+  codes = realloc (n->codes, sizeof (int) * (n->n_children + 1));
+  if (! codes)
+    return -1;
+  n->codes = codes;
+  children = realloc (n->children, sizeof (int) * (n->n_children + 1));
+  if (! children)
+    return -1;
+  n->children = children;
+  memmove (codes + lo + 1, codes + lo, sizeof (int) * (n->n_children - lo));
+  memmove (children + lo + 1, children + lo,
+	   sizeof (int) * (n->n_children - lo));
+  codes[lo] = c;
+  children[lo] = trie->used;
+  n->n_children++;
+  n = trie->nodes + trie->used;
+  n->idx = -1;
+  n->n_children = 0;
+  n->codes = n->children = NULL;
+  return trie->used++;
+}
+
+/* Make FontLayoutSeqTrie for the series of SEQ commands in COND of
+   STAGE.  Return NULL if the series is too short to be worth it, or
+   the creation fails.  */
+
+static FontLayoutSeqTrie *
+make_seq_trie (FontLayoutStage *stage, FontLayoutCmdCond *cond)
+{
+  FontLayoutSeqTrie *trie;
+  int i, j;
+
+  if (cond->seq_beg < 0 || cond->seq_end - cond->seq_beg < 2)
+    return NULL;
+  trie = malloc (sizeof (FontLayoutSeqTrie));
+  if (! trie)
+    return NULL;
+  trie->size = 64;
+  trie->nodes = malloc (sizeof (FontLayoutSeqNode) * trie->size);
+  if (! trie->nodes)
+    {
+      free (trie);
+      return NULL;
+    }
+  trie->used = 1;
+  trie->nodes[0].idx = -1;
+  trie->nodes[0].n_children = 0;
+  trie->nodes[0].codes = trie->nodes[0].children = NULL;
+  for (i = cond->seq_beg; i < cond->seq_end; i++)
+    {
+      FontLayoutCmdRule *rule
+	= &stage->cmds[CMD_ID_TO_INDEX (cond->cmd_ids[i])].body.rule;
+      int node = 0;
+
+      for (j = 0; j < rule->src.seq.n_codes && node >= 0; j++)
+	node = seq_trie_child (trie, node, rule->src.seq.codes[j], 1);
+      if (node < 0)
 	{
-	  FontLayoutCmd dummy;
-	  id = INDEX_TO_CMD_ID (stage->used);
-	  MLIST_APPEND1 (stage, cmds, dummy, MERROR_DRAW);
+	  free_seq_trie (trie);
+	  return NULL;
 	}
-      cmd = stage->cmds + CMD_ID_TO_INDEX (id);
+      if (trie->nodes[node].idx < 0)
+	trie->nodes[node].idx = i;
+    }
+  return trie;
+}
 
-      if (MPLIST_SYMBOL_P (elt))
-	{
-	  FontLayoutCmdCond *cond;
+/* Compiling the rules of regular expression in a cond command into
+   FontLayoutDFA.  Only a subset of POSIX extended regular expression
+   is supported.  If a pattern contains anything else, the cond
+   command is run by regexec () as before.  */
 
-	  if (MPLIST_SYMBOL (elt) != Mcond)
-	    MERROR (MERROR_DRAW, INVALID_CMD_ID);
-	  elt = MPLIST_NEXT (elt);
-	  cmd->type = FontLayoutCmdTypeCond;
-	  cond = &cmd->body.cond;
-	  cond->seq_beg = cond->seq_end = -1;
-	  cond->seq_from = cond->seq_to = 0;
-	  cond->n_cmds = len;
-	  MTABLE_CALLOC (cond->cmd_ids, len, MERROR_DRAW);
-	  for (i = 0; i < len; i++, elt = MPLIST_NEXT (elt))
-	    {
-	      int this_id = load_command (stage, elt, macros, INVALID_CMD_ID);
+/* Maximum numbers of nodes of NFA and states of DFA.  */
+#define DFA_MAX_NODES 4096
+#define DFA_MAX_STATES 1024
 
-	      if (this_id == INVALID_CMD_ID || this_id == -2)
-		MERROR (MERROR_DRAW, this_id);
-	      /* The above load_command may relocate stage->cmds.  */
-	      cmd = stage->cmds + CMD_ID_TO_INDEX (id);
-	      cond = &cmd->body.cond;
-	      cond->cmd_ids[i] = this_id;
-	      if (this_id <= CMD_ID_OFFSET_INDEX)
-		{
-		  FontLayoutCmd *this_cmd
-		    = stage->cmds + CMD_ID_TO_INDEX (this_id);
+enum DFATreeType
+  {
+    DFA_TREE_EMPTY,
+    DFA_TREE_SET,
+    DFA_TREE_CAT,
+    DFA_TREE_ALT,
+    DFA_TREE_REPEAT,
+    DFA_TREE_BOL,
+    DFA_TREE_EOL
+  };
 
-		  if (this_cmd->type == FontLayoutCmdTypeRule
-		      && this_cmd->body.rule.src_type == SRC_SEQ)
-		    {
-		      int first_char = this_cmd->body.rule.src.seq.codes[0];
+typedef struct
+{
+  enum DFATreeType type;
+  /* Operands of DFA_TREE_CAT, DFA_TREE_ALT, and DFA_TREE_REPEAT.  */
+  int a, b;
+  /* Range of DFA_TREE_REPEAT.  MAX is -1 for no limit.  */
+  int min, max;
+  /* Bytes matched by DFA_TREE_SET.  */
+  unsigned char set[32];
+} DFATree;
+
+enum DFANodeType
+  {
+    DFA_NODE_SET,
+    DFA_NODE_SPLIT,
+    DFA_NODE_BOL,
+    DFA_NODE_EOL,
+    DFA_NODE_MATCH
+  };
 
-		      if (cond->seq_beg < 0)
-			{
-			  /* The first SEQ command.  */
-			  cond->seq_beg = i;
-			  cond->seq_from = cond->seq_to = first_char;
-			}
-		      else if (cond->seq_end < 0)
-			{
-			  /* The following SEQ command.  */
-			  if (cond->seq_from > first_char)
-			    cond->seq_from = first_char;
-			  else if (cond->seq_to < first_char)
-			    cond->seq_to = first_char;
-			}
-		    }
-		  else
-		    {
-		      if (cond->seq_beg >= 0 && cond->seq_end < 0)
-			/* The previous one is the last SEQ command.  */
-			cond->seq_end = i;
-		    }
-		}
-	      else
-		{
-		  if (cond->seq_beg >= 0 && cond->seq_end < 0)
-		    /* The previous one is the last SEQ command.  */
-		    cond->seq_end = i;
-		}
-	    }
-	  if (cond->seq_beg >= 0 && cond->seq_end < 0)
-	    /* The previous one is the last SEQ command.  */
-	    cond->seq_end = i;
-	}
-      else
-	{
-	  cmd->type = FontLayoutCmdTypeRule;
-	  if (MPLIST_MTEXT_P (elt))
-	    {
-	      MText *mt = MPLIST_MTEXT (elt);
-	      char *str = (char *) MTEXT_DATA (mt);
+typedef struct
+{
+  enum DFANodeType type;
+  int out, out1;
+  /* Index of DFATree for DFA_NODE_SET, or index of the alternative
+     for DFA_NODE_MATCH.  */
+  int arg;
+} DFANode;
 
-	      if (str[0] != '^')
-		{
-		  mtext_ins_char (mt, 0, '^', 1);
-		  str = (char *) MTEXT_DATA (mt);
-		}
-	      if (regcomp (&cmd->body.rule.src.re.preg, str, REG_EXTENDED))
-		MERROR (MERROR_FONT, INVALID_CMD_ID);
-	      cmd->body.rule.src_type = SRC_REGEX;
-	      cmd->body.rule.src.re.pattern = strdup (str);
-	    }
-	  else if (MPLIST_INTEGER_P (elt))
-	    {
-	      cmd->body.rule.src_type = SRC_INDEX;
-	      cmd->body.rule.src.match_idx = MPLIST_INTEGER (elt);
-	    }
-	  else if (MPLIST_PLIST_P (elt))
-	    {
-	      MPlist *pl = MPLIST_PLIST (elt), *p;
-	      int size = MPLIST_LENGTH (pl);
+typedef struct
+{
+  const char *p;
+  DFATree *trees;
+  int n_trees, max_trees;
+  DFANode *nodes;
+  int n_nodes, max_nodes;
+  /* Used to collect a set of nodes.  */
+  int *mark, stamp;
+  int *set;
+  int n_set;
+} DFABuilder;
+
+#define SET_BIT(set, c) ((set)[(c) >> 3] |= 1 << ((c) & 7))
+#define BIT_P(set, c) ((set)[(c) >> 3] & (1 << ((c) & 7)))
 
-	      if (MPLIST_INTEGER_P (pl))
-		{
-		  int i;
+static int
+new_dfa_tree (DFABuilder *b, enum DFATreeType type, int a, int bb)
+{
+  DFATree *tree;
 
-		  cmd->body.rule.src_type = SRC_SEQ;
-		  cmd->body.rule.src.seq.n_codes = size;
-		  MTABLE_CALLOC (cmd->body.rule.src.seq.codes, size,
-				 MERROR_FONT);
-		  for (i = 0; i < size; i++, pl = MPLIST_NEXT (pl))
-		    {
-		      if (! MPLIST_INTEGER_P (pl))
-			MERROR (MERROR_DRAW, INVALID_CMD_ID);
-		      cmd->body.rule.src.seq.codes[i]
-			= (unsigned) MPLIST_INTEGER (pl);
-		    }
-		}
-	      else if (MPLIST_SYMBOL_P (pl))
-		{
-		  if (MPLIST_SYMBOL (pl) == Mrange)
-		    {
-		      if (size != 3)
-			MERROR (MERROR_FLT, INVALID_CMD_ID);
-		      cmd->body.rule.src_type = SRC_RANGE;
+  if (b->n_trees == b->max_trees)
+    {
+      int size = b->max_trees ? b->max_trees * 2 : 64;
+      DFATree *trees = realloc (b->trees, sizeof (DFATree) * size);
+
+      if (! trees)
+	return -1;
+      b->trees = trees;
+      b->max_trees = size;
+    }
+  tree = b->trees + b->n_trees;
+  memset (tree, 0, sizeof (DFATree));
+  tree->type = type;
+  tree->a = a, tree->b = bb;
+  return b->n_trees++;
+}
+
+static int parse_dfa_alt (DFABuilder *b);
+
+static int
+parse_dfa_bracket (DFABuilder *b, int tree)
+{
+  const unsigned char *p = (const unsigned char *) b->p;
+  unsigned char *set = b->trees[tree].set;
+  int negate = 0;
+  int i;
+
+  if (*p == '^')
+    negate = 1, p++;
+  if (*p == ']')
+    SET_BIT (set, ']'), p++;
+  while (*p != ']')
+    {
+      int c = *p, c1 = c;
+
+      if (! c || c >= 0x80 || (c == '[' && strchr (":.=", p[1])))
+	return -1;
+      if (p[1] == '-' && p[2] && p[2] != ']')
+	{
+	  c1 = p[2];
+	  if (c1 >= 0x80 || c1 < c)
+	    return -1;
+	  p += 2;
+	}
+      for (; c <= c1; c++)
+	SET_BIT (set, c);
+      p++;
+    }
+  b->p = (const char *) p + 1;
+  if (negate)
+    for (i = 0; i < 32; i++)
+      set[i] ^= 0xFF;
+  set[0] &= ~1;
+  for (i = 16; i < 32; i++)
+    set[i] = 0;
+  return tree;
+}
+
+static int
+parse_dfa_atom (DFABuilder *b)
+{
+  int c = (unsigned char) *b->p++;
+  int tree;
+
+  if (c == '(')
+    {
+      tree = parse_dfa_alt (b);
+      if (tree < 0 || *b->p != ')')
+	return -1;
+      b->p++;
+      return tree;
+    }
+  if (c == '^')
+    return new_dfa_tree (b, DFA_TREE_BOL, -1, -1);
+  if (c == '$')
+    return new_dfa_tree (b, DFA_TREE_EOL, -1, -1);
+  if (! c || c >= 0x80 || strchr (")*+?{", c))
+    return -1;
+  tree = new_dfa_tree (b, DFA_TREE_SET, -1, -1);
+  if (tree < 0)
+    return -1;
+  if (c == '[')
+    return parse_dfa_bracket (b, tree);
+  if (c == '.')
+    {
+      memset (b->trees[tree].set, 0xFF, 16);
+      b->trees[tree].set[0] &= ~1;
+      return tree;
+    }
+  if (c == '\\')
+    {
+      /* GNU extensions such as \w and back references are not
+	 supported.  */
+      c = (unsigned char) *b->p++;
+      if (! c || c >= 0x80 || isalnum (c))
+	return -1;
+    }
+  SET_BIT (b->trees[tree].set, c);
+  return tree;
+}
+
+static int
+parse_dfa_piece (DFABuilder *b)
+{
+  int tree = parse_dfa_atom (b);
+
+  while (tree >= 0 && *b->p && strchr ("*+?{", *b->p))
+    {
+      int c = *b->p++;
+      int min = 0, max = -1;
+
+      if (c == '+')
+	min = 1;
+      else if (c == '?')
+	max = 1;
+      else if (c == '{')
+	{
+	  if (! isdigit ((unsigned char) *b->p))
+	    return -1;
+	  min = strtol (b->p, (char **) &b->p, 10);
+	  max = min;
+	  if (*b->p == ',')
+	    {
+	      b->p++;
+	      max = (isdigit ((unsigned char) *b->p)
+		     ? strtol (b->p, (char **) &b->p, 10) : -1);
+	    }
+	  if (*b->p != '}' || min > 255 || max > 255
+	      || (max >= 0 && max < min))
+	    return -1;
+	  b->p++;
+	}
+      tree = new_dfa_tree (b, DFA_TREE_REPEAT, tree, -1);
+      if (tree >= 0)
+	b->trees[tree].min = min, b->trees[tree].max = max;
+    }
+  return tree;
+}
+
+static int
+parse_dfa_branch (DFABuilder *b)
+{
+  int tree = -1;
+
+  while (*b->p && *b->p != '|' && *b->p != ')')
+    {
+      int piece = parse_dfa_piece (b);
+
+      if (piece < 0)
+	return -1;
+      tree = (tree < 0 ? piece
+	      : new_dfa_tree (b, DFA_TREE_CAT, tree, piece));
+      if (tree < 0)
+	return -1;
+    }
+  return (tree < 0 ? new_dfa_tree (b, DFA_TREE_EMPTY, -1, -1) : tree);
+}
+
+static int
+parse_dfa_alt (DFABuilder *b)
+{
+  int tree = parse_dfa_branch (b);
+
+  while (tree >= 0 && *b->p == '|')
+    {
+      int branch;
+
+      b->p++;
+      branch = parse_dfa_branch (b);
+      if (branch < 0)
+	return -1;
+      tree = new_dfa_tree (b, DFA_TREE_ALT, tree, branch);
+    }
+  return tree;
+}
+
+static int
+new_dfa_node (DFABuilder *b, enum DFANodeType type, int out, int out1,
+	      int arg)
+{
+  DFANode *node;
+
+  if (b->n_nodes == b->max_nodes)
+    {
+      int size = b->max_nodes ? b->max_nodes * 2 : 64;
+      DFANode *nodes;
+
+      if (size > DFA_MAX_NODES)
+	return -1;
+      nodes = realloc (b->nodes, sizeof (DFANode) * size);
+      if (! nodes)
+	return -1;
+      b->nodes = nodes;
+      b->max_nodes = size;
+    }
+  node = b->nodes + b->n_nodes;
+  node->type = type;
+  node->out = out, node->out1 = out1;
+  node->arg = arg;
+  return b->n_nodes++;
+}
+
+/* Compile TREE into nodes followed by the node NEXT, and return the
+   first node.  */
+
+static int
+compile_dfa_tree (DFABuilder *b, int tree, int next)
+{
+  DFATree *t = b->trees + tree;
+  int node, i;
+
+  if (next < 0)
+    return -1;
+  switch (t->type)
+    {
+    case DFA_TREE_EMPTY:
+      return next;
+    case DFA_TREE_SET:
+      return new_dfa_node (b, DFA_NODE_SET, next, -1, tree);
+    case DFA_TREE_BOL:
+      return new_dfa_node (b, DFA_NODE_BOL, next, -1, 0);
+    case DFA_TREE_EOL:
+      return new_dfa_node (b, DFA_NODE_EOL, next, -1, 0);
+    case DFA_TREE_CAT:
+      return compile_dfa_tree (b, t->a, compile_dfa_tree (b, t->b, next));
+    case DFA_TREE_ALT:
+      {
+	int a = compile_dfa_tree (b, t->a, next);
+	int bb = compile_dfa_tree (b, t->b, next);
+
+	if (a < 0 || bb < 0)
+	  return -1;
+	return new_dfa_node (b, DFA_NODE_SPLIT, a, bb, 0);
+      }
+    default:			/* DFA_TREE_REPEAT */
+      {
+	int a = t->a, min = t->min, max = t->max;
+
+	if (max < 0)
+	  {
+	    int body;
+
+	    node = new_dfa_node (b, DFA_NODE_SPLIT, -1, next, 0);
+	    body = compile_dfa_tree (b, a, node);
+	    if (body < 0)
+	      return -1;
+	    b->nodes[node].out = body;
+	  }
+	else
+	  for (i = min, node = next; i < max && node >= 0; i++)
+	    {
+	      int body = compile_dfa_tree (b, a, node);
+
+	      node = (body < 0 ? -1
+		      : new_dfa_node (b, DFA_NODE_SPLIT, body, next, 0));
+	    }
+	for (i = 0; i < min; i++)
+	  node = compile_dfa_tree (b, a, node);
+	return node;
+      }
+    }
+}
+
+/* Add to B->set the nodes reached from NODE without consuming an
+   input.  BOL is nonzero at the beginning of the input, and EOL is
+   nonzero at the end.  */
+
+static void
+add_dfa_closure (DFABuilder *b, int node, int bol, int eol)
+{
+  while (node >= 0 && b->mark[node] != b->stamp)
+    {
+      DFANode *n = b->nodes + node;
+
+      b->mark[node] = b->stamp;
+      if (n->type == DFA_NODE_SPLIT)
+	{
+	  add_dfa_closure (b, n->out1, bol, eol);
+	  node = n->out;
+	}
+      else if (n->type == DFA_NODE_BOL)
+	node = bol ? n->out : -1;
+      else if (n->type == DFA_NODE_EOL && eol)
+	node = n->out;
+      else
+	{
+	  b->set[b->n_set++] = node;
+	  node = -1;
+	}
+    }
+}
+
+static int
+compare_int (const void *p1, const void *p2)
+{
+  return *(int *) p1 - *(int *) p2;
+}
+
+static void
+set_dfa_accept (DFABuilder *b, unsigned char *accept)
+{
+  int i;
+
+  for (i = 0; i < b->n_set; i++)
+    if (b->nodes[b->set[i]].type == DFA_NODE_MATCH)
+      SET_BIT (accept, b->nodes[b->set[i]].arg);
+}
+
+static void
+free_dfa (FontLayoutDFA *dfa)
+{
+  free (dfa->trans);
+  free (dfa->accept);
+  free (dfa);
+}
+
+/* Make FontLayoutDFA for the rules of regular expression in COND of
+   STAGE.  Return NULL if COND has no such rule, or any of them can't
+   be compiled.  */
+
+static FontLayoutDFA *
+make_dfa (FontLayoutStage *stage, FontLayoutCmdCond *cond)
+{
+  DFABuilder b;
+  FontLayoutDFA *dfa = NULL;
+  int *states = NULL, *state_index = NULL;
+  int n_states, max_states, n_states_data, max_states_data;
+  int root = -1, n_regex = 0;
+  int i, j, k;
+
+  memset (&b, 0, sizeof b);
+  for (i = 0; i < cond->n_cmds; i++)
+    {
+      FontLayoutCmd *cmd;
+      int tree, node;
+
+      if (cond->cmd_ids[i] > CMD_ID_OFFSET_INDEX)
+	continue;
+      cmd = stage->cmds + CMD_ID_TO_INDEX (cond->cmd_ids[i]);
+      if (cmd->type != FontLayoutCmdTypeRule
+	  || cmd->body.rule.src_type != SRC_REGEX)
+	continue;
+      b.p = cmd->body.rule.src.re.pattern;
+      tree = parse_dfa_alt (&b);
+      if (tree < 0 || *b.p)
+	goto fail;
+      node = new_dfa_node (&b, DFA_NODE_MATCH, -1, -1, i);
+      node = compile_dfa_tree (&b, tree, node);
+      root = (node < 0 ? -1
+	      : root < 0 ? node
+	      : new_dfa_node (&b, DFA_NODE_SPLIT, root, node, 0));
+      if (root < 0)
+	goto fail;
+      n_regex++;
+    }
+  if (! n_regex)
+    goto fail;
+
+  dfa = calloc (1, sizeof (FontLayoutDFA));
+  b.mark = calloc (b.n_nodes, sizeof (int));
+  b.set = malloc (sizeof (int) * b.n_nodes);
+  if (! dfa || ! b.mark || ! b.set)
+    goto fail;
+
+  /* Divide the input bytes into classes.  The bytes of the same class
+     are matched by the same nodes.  Byte 0 terminates the input.  */
+  dfa->n_classes = 1;
+  for (i = 0; i < b.n_nodes; i++)
+    if (b.nodes[i].type == DFA_NODE_SET)
+      {
+	unsigned char *set = b.trees[b.nodes[i].arg].set;
+	int map[256][2];
+	int n = 0;
+
+	for (j = 0; j < dfa->n_classes; j++)
+	  map[j][0] = map[j][1] = -1;
+	for (j = 1; j < 256; j++)
+	  {
+	    int in = BIT_P (set, j) != 0;
+	    int *cls = &map[dfa->class[j]][in];
+
+	    if (*cls < 0)
+	      *cls = n++;
+	    dfa->class[j] = *cls;
+	  }
+	dfa->n_classes = n;
+      }
+
+  /* Each state is kept in STATES as the number of nodes followed by
+     the sorted nodes.  STATE_INDEX[I] is the position of the Ith
+     state in STATES.  */
+  dfa->n_alts = cond->n_cmds;
+  dfa->alt_bytes = (cond->n_cmds + 7) / 8;
+  max_states = 16;
+  max_states_data = 256;
+  states = malloc (sizeof (int) * max_states_data);
+  state_index = malloc (sizeof (int) * max_states);
+  dfa->trans = malloc (sizeof (unsigned short)
+		       * max_states * dfa->n_classes);
+  if (! states || ! state_index || ! dfa->trans)
+    goto fail;
+  states[0] = 0;
+  state_index[0] = 0;
+  b.stamp++, b.n_set = 0;
+  add_dfa_closure (&b, root, 1, 0);
+  states[1] = b.n_set;
+  memcpy (states + 2, b.set, sizeof (int) * b.n_set);
+  qsort (states + 2, b.n_set, sizeof (int), compare_int);
+  state_index[1] = 1;
+  n_states = 2;
+  n_states_data = 2 + b.n_set;
+
+  for (i = 0; i < n_states; i++)
+    {
+      if (n_states > DFA_MAX_STATES)
+	goto fail;
+      for (k = 0; k < dfa->n_classes; k++)
+	{
+	  int *state = states + state_index[i];
+	  int c;
+
+	  for (c = 1; dfa->class[c] != k; c++);
+	  b.stamp++, b.n_set = 0;
+	  for (j = 1; j <= state[0]; j++)
+	    {
+	      DFANode *n = b.nodes + state[j];
+
+	      if (n->type == DFA_NODE_SET
+		  && BIT_P (b.trees[n->arg].set, c))
+		add_dfa_closure (&b, n->out, 0, 0);
+	    }
+	  if (b.n_set == 0)
+	    {
+	      dfa->trans[i * dfa->n_classes + k] = 0;
+	      continue;
+	    }
+	  qsort (b.set, b.n_set, sizeof (int), compare_int);
+	  for (j = 2; j < n_states; j++)
+	    if (states[state_index[j]] == b.n_set
+		&& ! memcmp (states + state_index[j] + 1, b.set,
+			     sizeof (int) * b.n_set))
+	      break;
+	  if (j == n_states)
+	    {
+	      if (n_states == max_states)
+		{
+		  int *p = realloc (state_index, sizeof (int) * max_states * 2);
+		  unsigned short *trans;
+
+		  if (! p)
+		    goto fail;
+		  state_index = p;
+		  max_states *= 2;
+		  trans = realloc (dfa->trans, (sizeof (unsigned short)
+						* max_states * dfa->n_classes));
+		  if (! trans)
+		    goto fail;
+		  dfa->trans = trans;
+		}
+	      if (n_states_data + 1 + b.n_set > max_states_data)
+		{
+		  int *p;
+
+		  while (n_states_data + 1 + b.n_set > max_states_data)
+		    max_states_data *= 2;
+		  p = realloc (states, sizeof (int) * max_states_data);
+		  if (! p)
+		    goto fail;
+		  states = p;
+		}
+	      state_index[n_states++] = n_states_data;
+	      states[n_states_data] = b.n_set;
+	      memcpy (states + n_states_data + 1, b.set,
+		      sizeof (int) * b.n_set);
+	      n_states_data += 1 + b.n_set;
+	    }
+	  dfa->trans[i * dfa->n_classes + k] = j;
+	}
+    }
+  if (n_states > DFA_MAX_STATES)
+    goto fail;
+
+  dfa->n_states = n_states;
+  dfa->accept = calloc (n_states * 2, dfa->alt_bytes);
+  if (! dfa->accept)
+    goto fail;
+  dfa->accept_end = dfa->accept + n_states * dfa->alt_bytes;
+  for (i = 1; i < n_states; i++)
+    {
+      int *state = states + state_index[i];
+
+      b.n_set = state[0];
+      memcpy (b.set, state + 1, sizeof (int) * b.n_set);
+      set_dfa_accept (&b, dfa->accept + i * dfa->alt_bytes);
+      b.stamp++, b.n_set = 0;
+      for (j = 1; j <= state[0]; j++)
+	if (b.nodes[state[j]].type == DFA_NODE_EOL)
+	  add_dfa_closure (&b, b.nodes[state[j]].out, i == 1, 1);
+	else if (b.nodes[state[j]].type == DFA_NODE_MATCH
+		 && b.mark[state[j]] != b.stamp)
+	  {
+	    b.mark[state[j]] = b.stamp;
+	    b.set[b.n_set++] = state[j];
+	  }
+      set_dfa_accept (&b, dfa->accept_end + i * dfa->alt_bytes);
+    }
+  free (states);
+  free (state_index);
+  free (b.trees);
+  free (b.nodes);
+  free (b.mark);
+  free (b.set);
+  return dfa;
+
+ fail:
+  if (dfa)
+    free_dfa (dfa);
+  free (states);
+  free (state_index);
+  free (b.trees);
+  free (b.nodes);
+  free (b.mark);
+  free (b.set);
+  return NULL;
+}
+
+/* Load a command from PLIST into STAGE, and return that
+   identification number.  If ID is not INVALID_CMD_ID, that means we
+   are loading a top level command or a macro.  In that case, use ID
+   as the identification number of the command.  Otherwise, generate a
+   new id number for the command.  MACROS is a list of raw macros.  */
+
+static int
+load_command (FontLayoutStage *stage, MPlist *plist,
+	      MPlist *macros, int id)
+{
+  int i;
+  int result;
+
+  if (MPLIST_INTEGER_P (plist))
+    {
+      int code = MPLIST_INTEGER (plist);
+
+      if (code < 0)
+	MERROR (MERROR_DRAW, INVALID_CMD_ID);
+      return code;
+    }
+  else if (MPLIST_PLIST_P (plist))
+    {
+      /* PLIST ::= ( cond ... ) | ( STRING ... ) | ( INTEGER ... )
+ 	           | ( ( INTEGER INTEGER ) ... )
+		   | ( ( range INTEGER INTEGER ) ... )
+	           | ( ( SYMBOL STRING ) ... )
+		   | ( ( font-facilty [ INTEGER ] ) ... )
+		   | ( ( font-facilty OTF-SPEC ) ... )  */
+      MPlist *elt = MPLIST_PLIST (plist);
+      int len = MPLIST_LENGTH (elt) - 1;
+      FontLayoutCmd *cmd;
+
+      if (id == INVALID_CMD_ID)
+	{
+	  FontLayoutCmd dummy;
+	  id = INDEX_TO_CMD_ID (stage->used);
+	  MLIST_APPEND1 (stage, cmds, dummy, MERROR_DRAW);
+	}
+      cmd = stage->cmds + CMD_ID_TO_INDEX (id);
+
+      if (MPLIST_SYMBOL_P (elt))
+	{
+	  FontLayoutCmdCond *cond;
+
+	  if (MPLIST_SYMBOL (elt) != Mcond)
+	    MERROR (MERROR_DRAW, INVALID_CMD_ID);
+	  elt = MPLIST_NEXT (elt);
+	  cmd->type = FontLayoutCmdTypeCond;
+	  cond = &cmd->body.cond;
+	  cond->seq_beg = cond->seq_end = -1;
+	  cond->seq_from = cond->seq_to = 0;
+	  cond->seq_trie = NULL;
+	  cond->dfa = NULL;
+	  cond->n_cmds = len;
+	  MTABLE_CALLOC (cond->cmd_ids, len, MERROR_DRAW);
+	  for (i = 0; i < len; i++, elt = MPLIST_NEXT (elt))
+	    {
+	      int this_id = load_command (stage, elt, macros, INVALID_CMD_ID);
+
+	      if (this_id == INVALID_CMD_ID || this_id == -2)
+		MERROR (MERROR_DRAW, this_id);
+	      /* The above load_command may relocate stage->cmds.  */
+	      cmd = stage->cmds + CMD_ID_TO_INDEX (id);
+	      cond = &cmd->body.cond;
+	      cond->cmd_ids[i] = this_id;
+	      if (this_id <= CMD_ID_OFFSET_INDEX)
+		{
+		  FontLayoutCmd *this_cmd
+		    = stage->cmds + CMD_ID_TO_INDEX (this_id);
+
+		  if (this_cmd->type == FontLayoutCmdTypeRule
+		      && this_cmd->body.rule.src_type == SRC_SEQ)
+		    {
+		      int first_char = this_cmd->body.rule.src.seq.codes[0];
+
+		      if (cond->seq_beg < 0)
+			{
+			  /* The first SEQ command.  */
+			  cond->seq_beg = i;
+			  cond->seq_from = cond->seq_to = first_char;
+			}
+		      else if (cond->seq_end < 0)
+			{
+			  /* The following SEQ command.  */
+			  if (cond->seq_from > first_char)
+			    cond->seq_from = first_char;
+			  else if (cond->seq_to < first_char)
+			    cond->seq_to = first_char;
+			}
+		    }
+		  else
+		    {
+		      if (cond->seq_beg >= 0 && cond->seq_end < 0)
+			/* The previous one is the last SEQ command.  */
+			cond->seq_end = i;
+		    }
+		}
+	      else
+		{
+		  if (cond->seq_beg >= 0 && cond->seq_end < 0)
+		    /* The previous one is the last SEQ command.  */
+		    cond->seq_end = i;
+		}
+	    }
+	  if (cond->seq_beg >= 0 && cond->seq_end < 0)
+	    /* The previous one is the last SEQ command.  */
+	    cond->seq_end = i;
+	}
+      else
+	{
+	  cmd->type = FontLayoutCmdTypeRule;
+	  if (MPLIST_MTEXT_P (elt))
+	    {
+	      MText *mt = MPLIST_MTEXT (elt);
+	      char *str = (char *) MTEXT_DATA (mt);
+
+	      if (str[0] != '^')
+		{
+		  mtext_ins_char (mt, 0, '^', 1);
+		  str = (char *) MTEXT_DATA (mt);
+		}
+	      if (regcomp (&cmd->body.rule.src.re.preg, str, REG_EXTENDED))
+		MERROR (MERROR_FONT, INVALID_CMD_ID);
+	      cmd->body.rule.src_type = SRC_REGEX;
+	      cmd->body.rule.src.re.pattern = strdup (str);
+	    }
+	  else if (MPLIST_INTEGER_P (elt))
+	    {
+	      cmd->body.rule.src_type = SRC_INDEX;
+	      cmd->body.rule.src.match_idx = MPLIST_INTEGER (elt);
+	    }
+	  else if (MPLIST_PLIST_P (elt))
+	    {
+	      MPlist *pl = MPLIST_PLIST (elt), *p;
+	      int size = MPLIST_LENGTH (pl);
+
+	      if (MPLIST_INTEGER_P (pl))
+		{
+		  int i;
+
+		  cmd->body.rule.src_type = SRC_SEQ;
+		  cmd->body.rule.src.seq.n_codes = size;
+		  MTABLE_CALLOC (cmd->body.rule.src.seq.codes, size,
+				 MERROR_FONT);
+		  for (i = 0; i < size; i++, pl = MPLIST_NEXT (pl))
+		    {
+		      if (! MPLIST_INTEGER_P (pl))
+			MERROR (MERROR_DRAW, INVALID_CMD_ID);
+		      cmd->body.rule.src.seq.codes[i]
+			= (unsigned) MPLIST_INTEGER (pl);
+		    }
+		}
+	      else if (MPLIST_SYMBOL_P (pl))
+		{
+		  if (MPLIST_SYMBOL (pl) == Mrange)
+		    {
+		      if (size != 3)
+			MERROR (MERROR_FLT, INVALID_CMD_ID);
+		      cmd->body.rule.src_type = SRC_RANGE;
 		      pl = MPLIST_NEXT (pl);
 		      if (! MPLIST_INTEGER_P (pl))
 			MERROR (MERROR_DRAW, INVALID_CMD_ID);
@@ -1276,7 +2209,13 @@ free_flt_command (FontLayoutCmd *cmd)
       free (rule->cmd_ids);
     }
   else if (cmd->type == FontLayoutCmdTypeCond)
-    free (cmd->body.cond.cmd_ids);
+    {
+      free (cmd->body.cond.cmd_ids);
+      if (cmd->body.cond.seq_trie)
+	free_seq_trie (cmd->body.cond.seq_trie);
+      if (cmd->body.cond.dfa)
+	free_dfa (cmd->body.cond.dfa);
+    }
   else if (cmd->type == FontLayoutCmdTypeOTF
 	   || cmd->type == FontLayoutCmdTypeOTFCategory)
     {
@@ -1325,6 +2264,14 @@ load_generator (MPlist *plist)
       free (stage);
       return NULL;
     }
+  for (result = 0; result < stage->used; result++)
+    if (stage->cmds[result].type == FontLayoutCmdTypeCond)
+      {
+	FontLayoutCmdCond *cond = &stage->cmds[result].body.cond;
+
+	cond->seq_trie = make_seq_trie (stage, cond);
+	cond->dfa = make_dfa (stage, cond);
+      }
 
   return stage;
 }
@@ -1479,6 +2426,18 @@ free_flt_stage (MFLT *flt, FontLayoutStage *stage)
 static void
 free_flt_list ()
 {
+  if (flt_index)
+    {
+      int i;
+
+      for (i = 0; i < flt_index_used; i++)
+	free (flt_index_candidates[i]);
+      free (flt_index_candidates);
+      flt_index_candidates = NULL;
+      flt_index_used = 0;
+      M17N_OBJECT_UNREF (flt_index);
+    }
+  memset (flt_find_memo, 0, sizeof flt_find_memo);
   if (flt_list)
     {
       MPlist *plist, *pl;
@@ -1565,6 +2524,63 @@ list_flt ()
 
 /* FLS (Font Layout Service) */
 
+/* Maximum number of OTF specs remembered in FLTRunFont.  */
+#define FLT_RUN_OTF_CHECKS 16
+
+/* Information about the font shared by the runs laid out by
+   mflt_run () or mflt_run_batch ().  */
+
+typedef struct
+{
+  MFLTFont *font;
+
+  /* Value of mflt_font_id () for FONT, or Mnil.  */
+  MSymbol font_id;
+
+  /* The last FLT configured for FONT, and the configured FLT.  */
+  MFLT *flt, *configured;
+
+  /* OTF specs already checked against FONT, and the results.  */
+  MFLTOtfSpec *otf_specs[FLT_RUN_OTF_CHECKS];
+  char otf_checked[FLT_RUN_OTF_CHECKS];
+  int otf_used;
+} FLTRunFont;
+
+static void
+setup_run_font (FLTRunFont *run_font, MFLTFont *font)
+{
+  run_font->font = font;
+  run_font->font_id = font && mflt_font_id ? mflt_font_id (font) : Mnil;
+  run_font->flt = run_font->configured = NULL;
+  run_font->otf_used = 0;
+}
+
+/* Check if the font of RUN_FONT supports SPEC.  The result of the
+   callback function check_otf of the font is remembered in RUN_FONT,
+   so that it is called only once for each SPEC while the font is
+   used.  */
+
+static int
+check_run_font_otf (FLTRunFont *run_font, MFLTOtfSpec *spec)
+{
+  MFLTFont *font = run_font->font;
+  int i, result;
+
+  if (! font->check_otf)
+    return (! (spec->features[0] && spec->features[0][0] != 0xFFFFFFFF)
+	    && ! (spec->features[1] && spec->features[1][0] != 0xFFFFFFFF));
+  for (i = 0; i < run_font->otf_used; i++)
+    if (run_font->otf_specs[i] == spec)
+      return run_font->otf_checked[i];
+  result = font->check_otf (font, spec) != 0;
+  if (run_font->otf_used < FLT_RUN_OTF_CHECKS)
+    {
+      run_font->otf_specs[run_font->otf_used] = spec;
+      run_font->otf_checked[run_font->otf_used++] = result;
+    }
+  return result;
+}
+
 /* Structure to hold information about a context of FLS.  */
 
 typedef struct
@@ -1578,9 +2594,15 @@ typedef struct
   /* Pointer to the font.  */
   MFLTFont *font;
 
+  /* Information about the font shared by the runs.  */
+  FLTRunFont *run_font;
+
   /* Input and output glyph string.  */
   MFLTGlyphString *in, *out;
 
+  /* Index of the scratch buffer holding the glyphs of OUT.  */
+  int out_scratch;
+
   /* Encode each character or code of a glyph by the current category
      table into this array.  An element is a category letter used for
      a regular expression matching.  */
@@ -1594,14 +2616,110 @@ typedef struct
   int combining_code;
   int left_padding;
   int check_mask;
+  /* If not NULL, points to the end of the match of the rule of
+     regular expression about to run found by run_dfa (), or -1 if
+     it doesn't match.  */
+  int *regex_match;
 } FontLayoutContext;
 
 static int run_command (int, int, int, int, FontLayoutContext *);
 static int run_otf (int, MFLTOtfSpec *, int, int, FontLayoutContext *);
 static int try_otf (int, MFLTOtfSpec *, int, int, FontLayoutContext *);
+static MFLT *find_flt (int, FLTRunFont *);
+static int run_flt (MFLTGlyphString *, int, int, MFLT *, FLTRunFont *);
+
+/* Make the output glyph string of CTX have room for N more glyphs.
+   Return 0 on success, -1 on memory shortage.  */
+
+static int
+grow_out (FontLayoutContext *ctx, int n)
+{
+  MFLTGlyphString *out = ctx->out;
+
+  if (out->allocated >= out->used + n)
+    return 0;
+  out->glyphs = get_flt_scratch (ctx->out_scratch,
+				 out->glyph_size * (out->used + n));
+  if (! out->glyphs)
+    MERROR (MERROR_FLT, -1);
+  out->allocated = flt_scratch[ctx->out_scratch].size / out->glyph_size;
+  return 0;
+}
+
+/* Call the drive_otf callback of the font of CTX for the glyphs from
+   FROM to TO of IN, and store the adjustments in *ADJUSTMENT.  If the
+   output glyph string is too short, grow it and call the callback
+   again.  Return the value of the last call, or -1 on memory
+   shortage.  */
+
+static int
+drive_otf (FontLayoutContext *ctx, MFLTOtfSpec *spec,
+	   MFLTGlyphString *in, int from, int to,
+	   MFLTGlyphAdjustment **adjustment)
+{
+  MFLTGlyphString *out = ctx->out;
+  int out_used = out->used;
+  int result, n;
+
+  if (grow_out (ctx, to - from) < 0)
+    return -1;
+  while (1)
+    {
+      n = out->allocated - out_used;
+      *adjustment = get_flt_scratch (FLT_SCRATCH_ADJUSTMENT,
+				     (sizeof (MFLTGlyphAdjustment)) * n);
+      if (! *adjustment)
+	MERROR (MERROR_FLT, -1);
+      memset (*adjustment, 0, (sizeof (MFLTGlyphAdjustment)) * n);
+      result = ctx->font->drive_otf (ctx->font, spec, in, from, to, out,
+				     *adjustment);
+      if (result != -2)
+	return result;
+      out->used = out_used;
+      if (grow_out (ctx, n + 1) < 0)
+	return -1;
+    }
+}
 
 #define NMATCH 20
 
+/* Match the encoded glyphs from FROM to TO against all the regular
+   expressions of DFA.  Store in ENDS[I] the end of the longest match
+   of the Ith command, or -1 if it doesn't match.  Return -1 if DFA
+   can't be used for the glyphs.  */
+
+static int
+run_dfa (FontLayoutDFA *dfa, int from, int to, FontLayoutContext *ctx,
+	 int *ends)
+{
+  unsigned char *p
+    = (unsigned char *) ctx->encoded + (from - ctx->encoded_offset);
+  int state = 1;
+  int i;
+
+  for (i = 0; i < dfa->n_alts; i++)
+    ends[i] = -1;
+  while (1)
+    {
+      int c = from < to ? *p : 0;
+      unsigned char *accept = ((c ? dfa->accept : dfa->accept_end)
+			       + state * dfa->alt_bytes);
+
+      for (i = 0; i < dfa->n_alts; i++)
+	if (BIT_P (accept, i))
+	  ends[i] = from;
+      if (c == 0)
+	break;
+      if (c >= 0x80)
+	return -1;
+      state = dfa->trans[state * dfa->n_classes + dfa->class[c]];
+      if (state == 0)
+	break;
+      from++, p++;
+    }
+  return 0;
+}
+
 static int
 run_rule (int depth,
 	  FontLayoutCmdRule *rule, int from, int to, FontLayoutContext *ctx)
@@ -1618,14 +2736,26 @@ run_rule (int depth,
       regmatch_t pmatch[NMATCH];
       char saved_code;
       int result;
+      int *match = ctx->regex_match;
 
-      if (from > to)
+      ctx->regex_match = NULL;
+      if (from > to || (match && *match < 0))
 	return 0;
       saved_code = ctx->encoded[to - ctx->encoded_offset];
       ctx->encoded[to - ctx->encoded_offset] = '\0';
-      result = regexec (&(rule->src.re.preg),
-			ctx->encoded + (from - ctx->encoded_offset),
-			NMATCH, pmatch, 0);
+      if (match && rule->src.re.preg.re_nsub == 0)
+	{
+	  /* We already know the result.  */
+	  result = 0;
+	  pmatch[0].rm_so = 0;
+	  pmatch[0].rm_eo = *match - from;
+	  for (i = 1; i < NMATCH; i++)
+	    pmatch[i].rm_so = pmatch[i].rm_eo = -1;
+	}
+      else
+	result = regexec (&(rule->src.re.preg),
+			  ctx->encoded + (from - ctx->encoded_offset),
+			  NMATCH, pmatch, 0);
       if (result == 0 && pmatch[0].rm_so == 0)
 	{
 	  if (MDEBUG_FLAG () > 2)
@@ -1773,7 +2903,7 @@ run_rule (int depth,
 	    {
 	      if (rule->src.facility.len == 0)
 		{
-		  if (! ctx->font->check_otf (ctx->font, spec))
+		  if (! check_run_font_otf (ctx->run_font, spec))
 		    return 0;
 		}
 	      else
@@ -1781,17 +2911,10 @@ run_rule (int depth,
 		  int prev_out_used = ctx->out->used, out_used;
 		  MFLTGlyphAdjustment *adjustment;
 
-		  adjustment = alloca ((sizeof *adjustment)
-				       * (ctx->out->allocated - ctx->out->used));
-		  if (! adjustment)
-		    MERROR (MERROR_FLT, -1);
-		  memset (adjustment, 0,
-			  (sizeof *adjustment)
-			  * (ctx->out->allocated - ctx->out->used));
-		  ctx->font->drive_otf (ctx->font, &rule->src.facility.otf_spec,
-					&gstring, 0, rule->src.facility.len,
-					ctx->out,
-					adjustment);
+		  if (drive_otf (ctx, &rule->src.facility.otf_spec,
+				 &gstring, 0, rule->src.facility.len,
+				 &adjustment) == -1)
+		    return -1;
 		  out_used = ctx->out->used;
 		  ctx->out->used = prev_out_used;
 		  if (rule->src.facility.len == out_used - prev_out_used)
@@ -1847,21 +2970,87 @@ run_rule (int depth,
   return (rule->src_type == SRC_INDEX ? orig_from : to);
 }
 
+/* Return the index of the first SEQ command in TRIE matching the
+   glyphs from FROM to TO, or -1 if none matches.  */
+
+static int
+lookup_seq_trie (FontLayoutSeqTrie *trie, int from, int to,
+		 FontLayoutContext *ctx)
+{
+  int node = 0, idx = -1;
+
+  for (; from < to; from++)
+    {
+      node = seq_trie_child (trie, node, GREF (ctx->in, from)->c, 0);
+      if (node < 0)
+	break;
+      if (trie->nodes[node].idx >= 0
+	  && (idx < 0 || trie->nodes[node].idx < idx))
+	idx = trie->nodes[node].idx;
+    }
+  return idx;
+}
+
 static int
 run_cond (int depth,
 	  FontLayoutCmdCond *cond, int from, int to, FontLayoutContext *ctx)
 {
   int i, pos = 0;
+  int *ends = NULL;
+  int dfa_state = 0;		/* 0: not run, 1: run, -1: unusable */
 
   if (MDEBUG_FLAG () > 2)
     MDEBUG_PRINT2 ("\n [FLT] %*s(COND", depth, "");
   depth++;
+  if (cond->dfa)
+    ends = alloca (sizeof (int) * cond->n_cmds);
   for (i = 0; i < cond->n_cmds; i++)
     {
-      /* TODO: Write a code for optimization utilizaing the info
-	 cond->seq_XXX.  */
-      if ((pos = run_command (depth, cond->cmd_ids[i], from, to, ctx))
-	  != 0)
+      int id = cond->cmd_ids[i];
+
+      if (i == cond->seq_beg)
+	{
+	  /* Skip the SEQ commands except for the first one matching
+	     the glyphs.  */
+	  int c = from < to ? GREF (ctx->in, from)->c : -1;
+	  int idx = -1;
+
+	  if (c >= cond->seq_from && c <= cond->seq_to)
+	    {
+	      if (cond->seq_trie)
+		idx = lookup_seq_trie (cond->seq_trie, from, to, ctx);
+	      else
+		idx = i;
+	    }
+	  if (idx < 0)
+	    {
+	      i = cond->seq_end - 1;
+	      continue;
+	    }
+	  i = idx;
+	  id = cond->cmd_ids[i];
+	}
+      if (ends && id <= CMD_ID_OFFSET_INDEX)
+	{
+	  FontLayoutCmd *cmd = ctx->stage->cmds + CMD_ID_TO_INDEX (id);
+
+	  if (cmd->type == FontLayoutCmdTypeRule
+	      && cmd->body.rule.src_type == SRC_REGEX)
+	    {
+	      if (dfa_state == 0)
+		dfa_state = (from > to ? -1
+			     : run_dfa (cond->dfa, from, to, ctx, ends) < 0
+			     ? -1 : 1);
+	      if (dfa_state > 0)
+		ctx->regex_match = ends + i;
+	    }
+	  else
+	    /* This command may change the encoded glyphs.  */
+	    dfa_state = 0;
+	}
+      else
+	dfa_state = 0;
+      if ((pos = run_command (depth, id, from, to, ctx)) != 0)
 	break;
     }
   if (pos < 0)
@@ -1905,7 +3094,7 @@ decode_packed_otf_tag (FontLayoutContext *ctx, MFLTGlyphString *gstring,
 	      }
 	}
       if (! enc)
-	enc = (g->c > 0 ? (int) mchartable_lookup (category->table, g->c)
+	enc = (g->c > 0 ? CATEGORY_CODE (category, g->c)
 	       : g->c == 0 ? 1 : ' ');
       SET_CATEGORY_CODE (g, enc);
     }
@@ -1924,8 +3113,8 @@ run_otf (int depth,
   font->get_glyph_id (font, ctx->in, from, to);
   if (! font->drive_otf)
     {
-      if (ctx->out->used + (to - from) > ctx->out->allocated)
-	return -2;
+      if (grow_out (ctx, to - from) < 0)
+	return -1;
       font->get_metrics (font, ctx->in, from, to);
       GCPY (ctx->in, from, to - from, ctx->out, ctx->out->used);
       ctx->out->used += to - from;
@@ -1936,14 +3125,7 @@ run_otf (int depth,
       int out_len;
       int i;
 
-      adjustment = alloca ((sizeof *adjustment)
-			   * (ctx->out->allocated - ctx->out->used));
-      if (! adjustment)
-	MERROR (MERROR_FLT, -1);
-      memset (adjustment, 0,
-	      (sizeof *adjustment) * (ctx->out->allocated - ctx->out->used));
-      to = font->drive_otf (font, otf_spec, ctx->in, from, to, ctx->out,
-			    adjustment);
+      to = drive_otf (ctx, otf_spec, ctx->in, from, to, &adjustment);
       if (to < 0)
 	return to;
       decode_packed_otf_tag (ctx, ctx->out, from_idx, ctx->out->used,
@@ -2031,7 +3213,7 @@ try_otf (int depth, MFLTOtfSpec *otf_spec, int from, int to,
   if (! otf_spec->features[0] && ! otf_spec->features[1])
     {
       /* Reset categories.  */
-      MCharTable *table = ctx->category->table;
+      FontLayoutCategory *category = ctx->category;
       int i;
 
       for (i = from; i < to; i++)
@@ -2040,12 +3222,7 @@ try_otf (int depth, MFLTOtfSpec *otf_spec, int from, int to,
 
 	  if (! GET_COMBINED (g))
 	    {
-	      char enc = (GET_ENCODED (g)
-			  ? (g->c > 0 ? (int) mchartable_lookup (table, g->c)
-			     : 1)
-			  : g->code
-			  ? (int) mchartable_lookup (table, g->code)
-			  : ' ');
+	      char enc = GLYPH_CATEGORY_CODE (category, g);
 	      SET_CATEGORY_CODE (g, enc);
 	      ctx->encoded[i - ctx->encoded_offset] = enc;
 	    }
@@ -2109,7 +3286,7 @@ run_command (int depth, int id, int from, int to, FontLayoutContext *ctx)
   if (id >= 0)
     {
       int i;
-      MCharTable *table = ctx->category ? ctx->category->table : NULL;
+      FontLayoutCategory *category = ctx->category;
       char enc;
 
       /* Direct code (== ctx->code_offset + id) output.
@@ -2123,13 +3300,9 @@ run_command (int depth, int id, int from, int to, FontLayoutContext *ctx)
       g->c = g->code = ctx->code_offset + id;
       if (ctx->combining_code)
 	SET_COMBINING_CODE (g, ctx, ctx->combining_code);
-      else if (table)
+      else if (category)
 	{
-	  enc = (GET_ENCODED (g)
-		 ? (g->c > 0 ? (int) mchartable_lookup (table, g->c) : 1)
-		 : g->code
-		 ? (int) mchartable_lookup (table, g->code)
-		 : ' ');
+	  enc = GLYPH_CATEGORY_CODE (category, g);
 	  SET_CATEGORY_CODE (g, enc);
 	}
       SET_ENCODED (g, 0);
@@ -2291,24 +3464,26 @@ run_stages (MFLTGlyphString *gstring, int from, int to,
 
   buf = *(ctx->in);
   buf.glyphs = NULL;
-  GINIT (ctx->out, ctx->out->allocated);
-  ctx->encoded = alloca (ctx->out->allocated);
-  if (! ctx->out->glyphs || ! ctx->encoded)
+  if (GINIT (ctx->out, FLT_SCRATCH_OUT, to - from) < 0)
     return -1;
+  ctx->out_scratch = FLT_SCRATCH_OUT;
 
   for (stage_idx = 0; 1; stage_idx++)
     {
-      MCharTable *table;
+      FontLayoutCategory *category;
       int result;
 
       ctx->stage = (FontLayoutStage *) MPLIST_VAL (stages);
-      table = ctx->stage->category->table;
+      category = ctx->stage->category;
       stages = MPLIST_NEXT (stages);
       if (MPLIST_TAIL_P (stages))
 	ctx->category = NULL;
       else
 	ctx->category = ((FontLayoutStage *) MPLIST_VAL (stages))->category;
       ctx->code_offset = ctx->combining_code = ctx->left_padding = 0;
+      ctx->encoded = get_flt_scratch (FLT_SCRATCH_ENCODED, to - from + 1);
+      if (! ctx->encoded)
+	return -1;
       ctx->encoded_offset = from;
       for (i = from; i < to; i++)
 	{
@@ -2318,11 +3493,7 @@ run_stages (MFLTGlyphString *gstring, int from, int to,
 	  if (GET_COMBINED (g)
 	      || (prev_category && prev_category != ctx->stage->category))
 	    {
-	      enc = (GET_ENCODED (g)
-		     ? (g->c > 0 ? (int) mchartable_lookup (table, g->c) : 1)
-		     : g->code
-		     ? (int) mchartable_lookup (table, g->code)
-		     : ' ');
+	      enc = GLYPH_CATEGORY_CODE (category, g);
 	      if (! GET_COMBINED (g))
 		SET_CATEGORY_CODE (g, enc);
 	    }
@@ -2374,9 +3545,12 @@ run_stages (MFLTGlyphString *gstring, int from, int to,
 	ctx->out = temp;
       else
 	{
-	  GINIT (&buf, ctx->out->allocated);
+	  if (GINIT (&buf, FLT_SCRATCH_BUF, ctx->in->used) < 0)
+	    return -1;
 	  ctx->out = &buf;
 	}
+      ctx->out_scratch = (ctx->out == &buf
+			  ? FLT_SCRATCH_BUF : FLT_SCRATCH_OUT);
       ctx->out->used = 0;
 
       from = 0;
@@ -2406,10 +3580,11 @@ run_stages (MFLTGlyphString *gstring, int from, int to,
       /* Check if all characters in the range are covered by some
 	 glyph(s).  If not, change <from> and <to> of glyphs to cover
 	 uncovered characters.  */
-      g_indices = alloca (sizeof (int) * len);
+      g_indices = get_flt_scratch (FLT_SCRATCH_INDICES,
+				   sizeof (int) * (len + 1));
       if (! g_indices)
 	return -1;
-      for (i = 0; i < len; i++) g_indices[i] = -1;
+      for (i = 0; i <= len; i++) g_indices[i] = -1;
       for (i = 0; i < ctx->out->used; i++)
 	{
 	  int pos;
@@ -2539,9 +3714,273 @@ run_stages (MFLTGlyphString *gstring, int from, int to,
 	  }
     }
 
-  GREPLACE (ctx->out, 0, ctx->out->used, gstring, orig_from, orig_to);
-  to = orig_from + ctx->out->used;
-  return to;
+  if (GREPLACE (ctx->out, 0, ctx->out->used, gstring, orig_from, orig_to) < 0)
+    return -2;
+  to = orig_from + ctx->out->used;
+  return to;
+}
+
+/* Cache of the results of run_stages ().  */
+
+/* Element of the key of a cache entry.  */
+
+typedef struct
+{
+  int c;
+  unsigned int code;
+  int encoded;
+} FLTCacheKey;
+
+typedef struct _FLTCacheEntry FLTCacheEntry;
+
+struct _FLTCacheEntry
+{
+  /* Next entry in the same bucket of flt_cache_table.  */
+  FLTCacheEntry *next;
+
+  /* Previous and next entries in the list of all entries.  The list
+     is sorted by the time of use, the most recently used first.  */
+  FLTCacheEntry *prev_used, *next_used;
+
+  unsigned hash;
+  MSymbol font_id;
+  int x_ppem, y_ppem;
+  MFLT *flt;
+
+  /* Number of input glyphs and output glyphs.  */
+  int len, nglyphs;
+
+  /* Input glyphs.  */
+  FLTCacheKey *key;
+
+  /* Output glyphs.  Their members from and to are relative to the
+     position of the first input glyph.  */
+  MFLTGlyph *glyphs;
+
+  /* Indices of the input glyphs the output glyphs were produced
+     from.  */
+  int *src;
+};
+
+#define FLT_CACHE_TABLE_SIZE 1024
+
+static FLTCacheEntry *flt_cache_table[FLT_CACHE_TABLE_SIZE];
+
+/* The most recently and the least recently used entries.  */
+static FLTCacheEntry *flt_cache_head, *flt_cache_tail;
+
+static int flt_cache_used;
+
+/* Set KEY for the glyphs between FROM and TO of GSTRING, and return
+   the hash value of KEY combined with FONT, FONT_ID, and FLT.  If the
+   glyphs can't be cached, return 0.  */
+
+static unsigned
+make_flt_cache_key (MFLTGlyphString *gstring, int from, int to,
+		    MFLTFont *font, MSymbol font_id, MFLT *flt,
+		    FLTCacheKey *key)
+{
+  unsigned hash = (((unsigned long) font_id >> 3)
+		   ^ ((unsigned long) flt >> 3)
+		   ^ (font->x_ppem << 16) ^ font->y_ppem);
+  int i;
+
+  memset (key, 0, sizeof (FLTCacheKey) * (to - from));
+  for (i = 0; from < to; from++, i++)
+    {
+      MFLTGlyph *g = GREF (gstring, from);
+
+      /* Metrics given by the caller may be different from the ones
+	 the font gives.  */
+      if (g->measured)
+	return 0;
+      key[i].c = g->c;
+      if (g->encoded)
+	{
+	  key[i].code = g->code;
+	  key[i].encoded = 1;
+	}
+      hash = (hash * 31) ^ g->c ^ (key[i].code << 8);
+    }
+  return (hash ? hash : 1);
+}
+
+static void
+unlink_flt_cache_entry (FLTCacheEntry *entry)
+{
+  if (entry->prev_used)
+    entry->prev_used->next_used = entry->next_used;
+  else
+    flt_cache_head = entry->next_used;
+  if (entry->next_used)
+    entry->next_used->prev_used = entry->prev_used;
+  else
+    flt_cache_tail = entry->prev_used;
+}
+
+static void
+link_flt_cache_entry (FLTCacheEntry *entry)
+{
+  entry->prev_used = NULL;
+  entry->next_used = flt_cache_head;
+  if (flt_cache_head)
+    flt_cache_head->prev_used = entry;
+  else
+    flt_cache_tail = entry;
+  flt_cache_head = entry;
+}
+
+static void
+free_flt_cache_entry (FLTCacheEntry *entry)
+{
+  FLTCacheEntry **p = flt_cache_table + entry->hash % FLT_CACHE_TABLE_SIZE;
+
+  for (; *p != entry; p = &(*p)->next);
+  *p = entry->next;
+  unlink_flt_cache_entry (entry);
+  free (entry);
+  flt_cache_used--;
+}
+
+static void
+free_flt_cache ()
+{
+  while (flt_cache_head)
+    free_flt_cache_entry (flt_cache_head);
+}
+
+/* Free the cache entries made by FLT.  */
+
+static void
+flush_flt_cache (MFLT *flt)
+{
+  FLTCacheEntry *entry, *next;
+
+  for (entry = flt_cache_head; entry; entry = next)
+    {
+      next = entry->next_used;
+      if (entry->flt == flt)
+	free_flt_cache_entry (entry);
+    }
+}
+
+static FLTCacheEntry *
+lookup_flt_cache (unsigned hash, MFLTFont *font, MSymbol font_id, MFLT *flt,
+		  FLTCacheKey *key, int len)
+{
+  FLTCacheEntry *entry;
+
+  for (entry = flt_cache_table[hash % FLT_CACHE_TABLE_SIZE]; entry;
+       entry = entry->next)
+    if (entry->hash == hash
+	&& entry->font_id == font_id
+	&& entry->flt == flt
+	&& entry->x_ppem == font->x_ppem
+	&& entry->y_ppem == font->y_ppem
+	&& entry->len == len
+	&& memcmp (entry->key, key, sizeof (FLTCacheKey) * len) == 0)
+      {
+	if (entry != flt_cache_head)
+	  {
+	    unlink_flt_cache_entry (entry);
+	    link_flt_cache_entry (entry);
+	  }
+	return entry;
+      }
+  return NULL;
+}
+
+/* Cache the glyphs between FROM and TO of GSTRING produced from the
+   input glyphs of KEY.  FROM_POS is the original position of the
+   first input glyph.  If not NULL, IN is a copy of the input glyphs
+   and is used to find which input glyph each output glyph was
+   produced from.  */
+
+static void
+store_flt_cache (unsigned hash, MFLTFont *font, MSymbol font_id, MFLT *flt,
+		 FLTCacheKey *key, int len, char *in,
+		 MFLTGlyphString *gstring, int from, int to, int from_pos)
+{
+  FLTCacheEntry *entry;
+  int extra = gstring->glyph_size - sizeof (MFLTGlyph);
+  int i, j;
+
+  while (flt_cache_used >= mflt_run_cache_size && flt_cache_tail)
+    free_flt_cache_entry (flt_cache_tail);
+  entry = malloc (sizeof (FLTCacheEntry) + sizeof (FLTCacheKey) * len
+		  + (sizeof (MFLTGlyph) + sizeof (int)) * (to - from));
+  if (! entry)
+    return;
+  entry->hash = hash;
+  entry->font_id = font_id;
+  entry->flt = flt;
+  entry->x_ppem = font->x_ppem;
+  entry->y_ppem = font->y_ppem;
+  entry->len = len;
+  entry->nglyphs = to - from;
+  entry->key = (FLTCacheKey *) (entry + 1);
+  memcpy (entry->key, key, sizeof (FLTCacheKey) * len);
+  entry->glyphs = (MFLTGlyph *) (entry->key + len);
+  entry->src = (int *) (entry->glyphs + (to - from));
+  for (i = 0; from < to; from++, i++)
+    {
+      MFLTGlyph *g = GREF (gstring, from);
+
+      entry->glyphs[i] = *g;
+      entry->glyphs[i].from -= from_pos;
+      entry->glyphs[i].to -= from_pos;
+      j = entry->glyphs[i].from;
+      if (in && extra > 0)
+	for (j = 0; j < len; j++)
+	  if (memcmp ((char *) (g + 1),
+		      in + gstring->glyph_size * j + sizeof (MFLTGlyph),
+		      extra) == 0)
+	    break;
+      if (j < 0 || j >= len)
+	j = j < 0 ? 0 : len - 1;
+      entry->src[i] = j;
+    }
+  entry->next = flt_cache_table[hash % FLT_CACHE_TABLE_SIZE];
+  flt_cache_table[hash % FLT_CACHE_TABLE_SIZE] = entry;
+  link_flt_cache_entry (entry);
+  flt_cache_used++;
+}
+
+/* Replace the glyphs between FROM and TO of GSTRING with the glyphs
+   of ENTRY.  The data following MFLTGlyph in each glyph (if any) is
+   copied from the input glyph the glyph was produced from.  Return
+   the new position of TO, or -2 if GSTRING is too short.  */
+
+static int
+replay_flt_cache (FLTCacheEntry *entry, MFLTGlyphString *gstring,
+		  int from, int to)
+{
+  int from_pos = GREF (gstring, from)->from;
+  int inc = entry->nglyphs - (to - from);
+  MFLTGlyphString in;
+  int i;
+
+  if (gstring->allocated < gstring->used + inc)
+    return -2;
+  in = *gstring;
+  if (GINIT (&in, FLT_SCRATCH_REPLAY, to - from) < 0)
+    return -1;
+  GCPY (gstring, from, to - from, &in, 0);
+  if (inc != 0 && to < gstring->used)
+    memmove ((char *) gstring->glyphs + gstring->glyph_size * (to + inc),
+	     (char *) gstring->glyphs + gstring->glyph_size * to,
+	     gstring->glyph_size * (gstring->used - to));
+  gstring->used += inc;
+  for (i = 0; i < entry->nglyphs; i++)
+    {
+      MFLTGlyph *g = GREF (gstring, from + i);
+
+      GCPY (&in, entry->src[i], 1, gstring, from + i);
+      *g = entry->glyphs[i];
+      g->from += from_pos;
+      g->to += from_pos;
+    }
+  return from + entry->nglyphs;
 }
 
 static void
@@ -2582,16 +4021,190 @@ setup_combining_flt (MFLT *flt)
   if (combininig_class_table)
     mchartable_map (combininig_class_table, (void *) 0,
 		    setup_combining_coverage, flt->coverage->table);
+  make_category_codes (flt->coverage);
 }
 
 #define CHECK_FLT_STAGES(flt) ((flt)->stages || load_flt (flt, NULL) == 0)
 
+/* Element of the boundaries of FLT coverages.  At POS, the coverage
+   of the IDXth FLT begins if INC is 1, or ends if INC is -1.  */
+
+typedef struct
+{
+  int pos, idx, inc;
+} FLTIndexEvent;
+
+typedef struct
+{
+  FLTIndexEvent *events;
+  int used, size;
+  int idx;
+  int error;
+} FLTIndexArg;
+
+static void
+add_flt_index_event (int from, int to, void *val, void *arg)
+{
+  FLTIndexArg *index_arg = arg;
+
+  if (index_arg->used + 2 > index_arg->size)
+    {
+      int size = index_arg->size ? index_arg->size * 2 : 256;
+      FLTIndexEvent *events = realloc (index_arg->events,
+				       sizeof (FLTIndexEvent) * size);
+
+      if (! events)
+	{
+	  index_arg->error = 1;
+	  return;
+	}
+      index_arg->events = events;
+      index_arg->size = size;
+    }
+  index_arg->events[index_arg->used].pos = from;
+  index_arg->events[index_arg->used].idx = index_arg->idx;
+  index_arg->events[index_arg->used++].inc = 1;
+  index_arg->events[index_arg->used].pos = to + 1;
+  index_arg->events[index_arg->used].idx = index_arg->idx;
+  index_arg->events[index_arg->used++].inc = -1;
+}
+
+static int
+compare_flt_index_event (const void *p1, const void *p2)
+{
+  return ((FLTIndexEvent *) p1)->pos - ((FLTIndexEvent *) p2)->pos;
+}
+
+/* Make flt_index from the coverages of the FLTs in flt_list.  */
+
+static int
+make_flt_index ()
+{
+  MPlist *plist, *pl;
+  FLTIndexArg arg;
+  MFLT **flts, **candidates;
+  int *active;
+  int n_flts = 0, n;
+  int i, j;
+
+  plist = flt_list;
+  MPLIST_DO (pl, plist)
+    n_flts++;
+  flts = alloca (sizeof (MFLT *) * n_flts);
+  candidates = alloca (sizeof (MFLT *) * (n_flts + 1));
+  active = alloca (sizeof (int) * n_flts);
+  memset (active, 0, sizeof (int) * n_flts);
+  memset (&arg, 0, sizeof arg);
+  i = 0;
+  MPLIST_DO (pl, plist)
+    {
+      MFLT *flt = MPLIST_VAL (pl);
+
+      if (flt->name == Mcombining
+	  && ! mchartable_lookup (flt->coverage->table, 0))
+	setup_combining_flt (flt);
+      flts[i] = flt;
+      arg.idx = i++;
+      mchartable_map (flt->coverage->table, (void *) 0,
+		      add_flt_index_event, &arg);
+    }
+  if (arg.error)
+    goto err;
+  qsort (arg.events, arg.used, sizeof (FLTIndexEvent),
+	 compare_flt_index_event);
+
+  flt_index = mchartable (Mnil, NULL);
+  for (i = 0; i < arg.used; )
+    {
+      int from = arg.events[i].pos;
+
+      for (; i < arg.used && arg.events[i].pos == from; i++)
+	active[arg.events[i].idx] += arg.events[i].inc;
+      if (i == arg.used)
+	break;
+      for (j = n = 0; j < n_flts; j++)
+	if (active[j] > 0)
+	  candidates[n++] = flts[j];
+      if (n == 0)
+	continue;
+      candidates[n++] = NULL;
+      for (j = flt_index_used - 1; j >= 0; j--)
+	if (! memcmp (flt_index_candidates[j], candidates,
+		      sizeof (MFLT *) * n))
+	  break;
+      if (j < 0)
+	{
+	  MFLT ***p = realloc (flt_index_candidates,
+			       sizeof (MFLT **) * (flt_index_used + 1));
+
+	  if (! p)
+	    goto err;
+	  flt_index_candidates = p;
+	  j = flt_index_used;
+	  if (! (p[j] = malloc (sizeof (MFLT *) * n)))
+	    goto err;
+	  memcpy (p[j], candidates, sizeof (MFLT *) * n);
+	  flt_index_used++;
+	}
+      mchartable_set_range (flt_index, from, arg.events[i].pos - 1,
+			    flt_index_candidates[j]);
+    }
+  free (arg.events);
+  return 0;
+
+ err:
+  free (arg.events);
+  if (flt_index)
+    {
+      for (i = 0; i < flt_index_used; i++)
+	free (flt_index_candidates[i]);
+      free (flt_index_candidates);
+      flt_index_candidates = NULL;
+      flt_index_used = 0;
+      M17N_OBJECT_UNREF (flt_index);
+    }
+  return -1;
+}
+
+/* Check if FLT is usable with the font of RUN_FONT.  Return 1 if FLT
+   is specified for the font by an OTF spec, 0 if FLT is usable, and
+   -1 otherwise.  */
+
+static int
+check_flt_font (MFLT *flt, FLTRunFont *run_font)
+{
+  MFLTFont *font = run_font->font;
+  static MSymbol unicode_bmp = NULL, unicode_full = NULL;
+
+  if (! unicode_bmp)
+    {
+      unicode_bmp = msymbol ("unicode-bmp");
+      unicode_full = msymbol ("unicode-full");
+    }
+
+  if (flt->registry != unicode_bmp
+      && flt->registry != unicode_full)
+    return -1;
+  if (flt->family && flt->family != font->family)
+    return -1;
+  if (flt->name == Mcombining
+      && ! mchartable_lookup (flt->coverage->table, 0))
+    setup_combining_flt (flt);
+  if (flt->otf.sym)
+    {
+      if (! check_run_font_otf (run_font, &flt->otf))
+	return -1;
+      return 1;
+    }
+  return 0;
+}
+
 static FontLayoutCategory *
 configure_category (FontLayoutCategory *category, MFLTFont *font)
 {
   if (! mflt_font_id || ! mflt_iterate_otf_feature)
     {
-      FontLayoutCategory *new = malloc (sizeof (FontLayoutCategory));
+      FontLayoutCategory *new = calloc (1, sizeof (FontLayoutCategory));
       new->definition = NULL;
       new->table = category->table;
       M17N_OBJECT_REF (new->table);
@@ -2600,25 +4213,144 @@ configure_category (FontLayoutCategory *category, MFLTFont *font)
   return load_category_table (category->definition, font);
 }
 
+/* Registry of FLTs configured for fonts.  */
+
+typedef struct _FLTConfigEntry FLTConfigEntry;
+
+struct _FLTConfigEntry
+{
+  /* Next entry in the same bucket of flt_config_table.  */
+  FLTConfigEntry *next;
+
+  /* Previous and next entries in the list of all entries sorted by
+     the time of use, the most recently used first.  */
+  FLTConfigEntry *prev_used, *next_used;
+
+  /* FLT configured for the font FONT_ID into CONFIGURED.  */
+  MFLT *flt;
+  MSymbol font_id;
+  MFLT *configured;
+};
+
+#define FLT_CONFIG_TABLE_SIZE 256
+
+/* Maximum number of configured FLTs.  */
+#define FLT_CONFIG_MAX 256
+
+static FLTConfigEntry *flt_config_table[FLT_CONFIG_TABLE_SIZE];
+static FLTConfigEntry *flt_config_head, *flt_config_tail;
+static int flt_config_used;
+
+#define FLT_CONFIG_HASH(flt, font_id)				\
+  (((((unsigned long) (flt)) ^ ((unsigned long) (font_id))) >> 3)	\
+   % FLT_CONFIG_TABLE_SIZE)
+
+/* Free CONFIGURED made from FLT by configure_flt ().  The commands
+   and the coverage are shared with FLT.  */
+
+static void
+free_configured_flt (MFLT *flt, MFLT *configured)
+{
+  MPlist *plist, *pl;
+
+  for (plist = configured->stages, pl = flt->stages;
+       ! MPLIST_TAIL_P (plist);
+       plist = MPLIST_NEXT (plist), pl = MPLIST_NEXT (pl))
+    {
+      FontLayoutStage *stage = MPLIST_VAL (plist);
+
+      if (stage != MPLIST_VAL (pl))
+	{
+	  unref_category_table (stage->category);
+	  free (stage);
+	}
+      else
+	M17N_OBJECT_UNREF (stage->category->table);
+    }
+  M17N_OBJECT_UNREF (configured->stages);
+  flush_flt_cache (configured);
+  free (configured);
+}
+
+static void
+unlink_flt_config_entry (FLTConfigEntry *entry)
+{
+  if (entry->prev_used)
+    entry->prev_used->next_used = entry->next_used;
+  else
+    flt_config_head = entry->next_used;
+  if (entry->next_used)
+    entry->next_used->prev_used = entry->prev_used;
+  else
+    flt_config_tail = entry->prev_used;
+}
+
+static void
+link_flt_config_entry (FLTConfigEntry *entry)
+{
+  entry->prev_used = NULL;
+  entry->next_used = flt_config_head;
+  if (flt_config_head)
+    flt_config_head->prev_used = entry;
+  else
+    flt_config_tail = entry;
+  flt_config_head = entry;
+}
+
+static void
+free_flt_config_entry (FLTConfigEntry *entry)
+{
+  FLTConfigEntry **p
+    = flt_config_table + FLT_CONFIG_HASH (entry->flt, entry->font_id);
+
+  for (; *p != entry; p = &(*p)->next);
+  *p = entry->next;
+  unlink_flt_config_entry (entry);
+  free_configured_flt (entry->flt, entry->configured);
+  free (entry);
+  flt_config_used--;
+}
+
+static void
+free_flt_config ()
+{
+  while (flt_config_head)
+    free_flt_config_entry (flt_config_head);
+}
+
+/* Return FLT configured for FONT whose ID is FONT_ID.  The returned
+   FLT is valid only until the next call of this function.  */
+
 static MFLT *
 configure_flt (MFLT *flt, MFLTFont *font, MSymbol font_id)
 {
   MPlist *plist;
   MFLT *configured;
+  FLTConfigEntry *entry;
+  int hash;
 
   if (! mflt_font_id || ! mflt_iterate_otf_feature)
     return flt;
-  MPLIST_DO (plist, flt_list)
+  hash = FLT_CONFIG_HASH (flt, font_id);
+  for (entry = flt_config_table[hash]; entry; entry = entry->next)
+    if (entry->flt == flt && entry->font_id == font_id)
+      {
+	if (entry != flt_config_head)
+	  {
+	    unlink_flt_config_entry (entry);
+	    link_flt_config_entry (entry);
+	  }
+	return entry->configured;
+      }
+  if (flt_config_used >= FLT_CONFIG_MAX)
+    free_flt_config_entry (flt_config_tail);
+  if (! MSTRUCT_CALLOC_SAFE (entry))
+    return flt;
+  if (! MSTRUCT_CALLOC_SAFE (configured))
     {
-      configured = MPLIST_VAL (plist);
-      if (! configured->font_id)
-	break;
-      if (configured->name == flt->name
-	  && configured->font_id == font_id)
-	return configured;
+      free (entry);
+      return flt;
     }
-  if (! MSTRUCT_CALLOC_SAFE (configured))
-    return flt;
   *configured = *flt;
   configured->stages = mplist_copy (flt->stages);
   MPLIST_DO (plist, configured->stages)
@@ -2636,7 +4368,13 @@ configure_flt (MFLT *flt, MFLTFont *font, MSymbol font_id)
     }
   configured->need_config = 0;
   configured->font_id = font_id;
-  mplist_push (flt_list, flt->name, configured);
+  entry->flt = flt;
+  entry->font_id = font_id;
+  entry->configured = configured;
+  entry->next = flt_config_table[hash];
+  flt_config_table[hash] = entry;
+  link_flt_config_entry (entry);
+  flt_config_used++;
   return configured;
 }
 
@@ -2678,6 +4416,7 @@ m17n_init_flt (void)
   Mend = msymbol ("end");
 
   mflt_enable_new_feature = 0;
+  mflt_run_cache_size = 0;
   mflt_iterate_otf_feature = NULL;
   mflt_font_id = NULL;
   mflt_try_otf = NULL;
@@ -2696,7 +4435,10 @@ m17n_fini_flt (void)
     return;
 
   MDEBUG_PUSH_TIME ();
+  free_flt_cache ();
+  free_flt_config ();
   free_flt_list ();
+  free_flt_scratch ();
   MDEBUG_PRINT_TIME ("FINI", (mdebug__output, " to finalize the flt modules."));
   MDEBUG_POP_TIME ();
   m17n_fini_core ();
@@ -2732,14 +4474,10 @@ MFLT *
 mflt_get (MSymbol name)
 {
   MFLT *flt;
-  MPlist *plist;
 
   if (! flt_list && list_flt () < 0)
     return NULL;
-  for (plist = flt_list; plist; plist = plist->next)
-    if (((MFLT *) MPLIST_VAL (plist))->font_id == Mnil)
-      break;
-  flt = mplist_get (plist, name);
+  flt = mplist_get (flt_list, name);
   if (! flt || ! CHECK_FLT_STAGES (flt))
     return NULL;
   if (flt->name == Mcombining
@@ -2773,77 +4511,98 @@ mflt_get (MSymbol name)
 MFLT *
 mflt_find (int c, MFLTFont *font)
 {
-  MPlist *plist, *pl;
-  MFLT *flt;
-  static MSymbol unicode_bmp = NULL, unicode_full = NULL;
+  FLTRunFont run_font;
 
-  if (! unicode_bmp)
-    {
-      unicode_bmp = msymbol ("unicode-bmp");
-      unicode_full = msymbol ("unicode-full");
-    }
+  setup_run_font (&run_font, font);
+  return find_flt (c, &run_font);
+}
+
+/* Find an FLT for character C and the font of RUN_FONT.  This is the
+   body of mflt_find ().  */
+
+static MFLT *
+find_flt (int c, FLTRunFont *run_font)
+{
+  MFLTFont *font = run_font->font;
+  MPlist *pl;
+  MFLT *flt;
+  MFLT **candidates;
+  FLTFindMemo *memo = NULL;
+  int result;
 
   if (! flt_list && list_flt () < 0)
     return NULL;
-  /* Skip configured FLTs.  */
-  MPLIST_DO (plist, flt_list)
-    if (((MFLT *) MPLIST_VAL (plist))->font_id == Mnil)
-      break;
-  if (font)
+  if (c < 0)
     {
       MFLT *best = NULL;
 
-      MPLIST_DO (pl, plist)
+      if (! font)
+	return NULL;
+      MPLIST_DO (pl, flt_list)
 	{
 	  flt = MPLIST_VAL (pl);
-	  if (flt->registry != unicode_bmp
-	      && flt->registry != unicode_full)
-	    continue;
-	  if (flt->family && flt->family != font->family)
-	    continue;
-	  if (flt->name == Mcombining
-	      && ! mchartable_lookup (flt->coverage->table, 0))
-	    setup_combining_flt (flt);
-	  if (c >= 0
-	      && ! mchartable_lookup (flt->coverage->table, c))
-	    continue;
-	  if (flt->otf.sym)
-	    {
-	      MFLTOtfSpec *spec = &flt->otf;
-
-	      if (! font->check_otf)
-		{
-		  if ((spec->features[0] && spec->features[0][0] != 0xFFFFFFFF)
-		      || (spec->features[1] && spec->features[1][0] != 0xFFFFFFFF))
-		    continue;
-		}
-	      else if (! font->check_otf (font, spec))
-		continue;
-	      goto found;
-	    }
-	  best = flt;
+	  result = check_flt_font (flt, run_font);
+	  if (result > 0)
+	    goto found;
+	  if (result == 0)
+	    best = flt;
 	}
       if (best == NULL)
 	return NULL;
       flt = best;
       goto found;
     }
-  if (c >= 0)
+
+  if (! flt_index && make_flt_index () < 0)
+    return NULL;
+  candidates = mchartable_lookup (flt_index, c);
+  if (! candidates)
+    return NULL;
+  if (! font)
+    {
+      flt = candidates[0];
+      goto found;
+    }
+  if (run_font->font_id != Mnil)
     {
-      MPLIST_DO (pl, plist)
+      MSymbol font_id = run_font->font_id;
+
+      memo = flt_find_memo + ((((unsigned long) font_id
+				^ (unsigned long) candidates) >> 3)
+			      % FLT_FIND_MEMO_SIZE);
+      if (memo->font_id == font_id && memo->candidates == candidates)
 	{
-	  flt = MPLIST_VAL (pl);
-	  if (mchartable_lookup (flt->coverage->table, c))
-	    goto found;
+	  flt = memo->flt;
+	  if (! flt)
+	    return NULL;
+	  goto found;
 	}
+      memo->font_id = font_id;
+      memo->candidates = candidates;
     }
-  return NULL;
+  {
+    MFLT *best = NULL;
+    int i;
+
+    for (i = 0; (flt = candidates[i]); i++)
+      {
+	result = check_flt_font (flt, run_font);
+	if (result > 0)
+	  break;
+	if (result == 0)
+	  best = flt;
+      }
+    if (! flt)
+      flt = best;
+    if (memo)
+      memo->flt = flt;
+    if (! flt)
+      return NULL;
+  }
 
  found:
   if (! CHECK_FLT_STAGES (flt))
     return NULL;
-  if (font && flt->need_config && mflt_font_id)
-    flt = configure_flt (flt, font, mflt_font_id (font));
   return flt;
 }
 
@@ -2926,22 +4685,36 @@ mflt_coverage (MFLT *flt)
 int
 mflt_run (MFLTGlyphString *gstring, int from, int to,
 	  MFLTFont *font, MFLT *flt)
+{
+  FLTRunFont run_font;
+
+  setup_run_font (&run_font, font);
+  return run_flt (gstring, from, to, flt, &run_font);
+}
+
+/* Layout the glyphs between FROM and TO of GSTRING with the font of
+   RUN_FONT.  This is the body of mflt_run ().  */
+
+static int
+run_flt (MFLTGlyphString *gstring, int from, int to, MFLT *flt,
+	 FLTRunFont *run_font)
 {
   FontLayoutContext ctx;
   int match_indices[NMATCH];
   MFLTGlyph *g;
   MFLTGlyphString out;
+  MFLTFont *font = run_font->font;
   int auto_flt = ! flt;
   int c, i, j, k;
   int this_from, this_to;
-  MSymbol font_id = mflt_font_id ? mflt_font_id (font) : Mnil;
+  MSymbol font_id = run_font->font_id;
+  FLTCacheKey *cache_key = NULL;
+  char *cache_in = NULL;
+  FLTCacheEntry *cache_entry;
+  unsigned cache_hash;
 
   out = *gstring;
   out.glyphs = NULL;
-  /* This is usually sufficient, but if not, we retry with the larger
-     values at most 3 times.  This value is also used for the
-     allocating size of ctx.encoded.  */
-  out.allocated = (to - from) * 4;
 
   for (i = from; i < to; i++)
     {
@@ -2960,8 +4733,7 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
       if (! auto_flt)
 	{
 	  for (this_to = this_from; this_to < to; this_to++)
-	    if (mchartable_lookup (flt->coverage->table,
-				   GREF (gstring, this_to)->c))
+	    if (CATEGORY_CODE (flt->coverage, GREF (gstring, this_to)->c))
 	      break;
 	}
       else
@@ -2983,12 +4755,12 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
 	    {
 	      c = GREF (gstring, this_to)->c;
 	      if (font->internal
-		  && mchartable_lookup (((MFLT *) font->internal)->coverage->table, c))
+		  && CATEGORY_CODE (((MFLT *) font->internal)->coverage, c))
 		{
 		  flt = font->internal;
 		  break;
 		}
-	      flt = mflt_find (c, font);
+	      flt = find_flt (c, run_font);
 	      if (flt)
 		{
 		  if (CHECK_FLT_STAGES (flt))
@@ -3012,13 +4784,20 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
       MDEBUG_PRINT1 (" [FLT] (%s", MSYMBOL_NAME (flt->name));
 
       if (flt->need_config && font_id != Mnil)
-	flt = configure_flt (flt, font, font_id);
+	{
+	  if (flt != run_font->flt)
+	    {
+	      run_font->flt = flt;
+	      run_font->configured = configure_flt (flt, font, font_id);
+	    }
+	  flt = run_font->configured;
+	}
 
       for (; this_to < to; this_to++)
 	{
 	  char enc;
 	  g = GREF (gstring, this_to);
-	  enc = (int) mchartable_lookup (flt->coverage->table, g->c);
+	  enc = CATEGORY_CODE (flt->coverage, g->c);
 	  if (! enc)
 	    break;
 	  SET_CATEGORY_CODE (g, enc);
@@ -3038,19 +4817,57 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
 	  MDEBUG_PRINT (")");
 	}
 
-      for (i = 0; i < 3; i++)
+      cache_hash = 0;
+      cache_entry = NULL;
+      if (mflt_run_cache_size > 0 && font_id != Mnil)
+	{
+	  cache_key = get_flt_scratch (FLT_SCRATCH_CACHE_KEY,
+				       sizeof (FLTCacheKey)
+				       * (this_to - this_from));
+	  if (! cache_key)
+	    return -1;
+	  cache_hash = make_flt_cache_key (gstring, this_from, this_to,
+					   font, font_id, flt, cache_key);
+	  if (cache_hash)
+	    cache_entry = lookup_flt_cache (cache_hash, font, font_id, flt,
+					    cache_key, this_to - this_from);
+	  cache_in = NULL;
+	  if (cache_hash && ! cache_entry
+	      && gstring->glyph_size > sizeof (MFLTGlyph))
+	    {
+	      cache_in = get_flt_scratch (FLT_SCRATCH_CACHE_IN,
+					  gstring->glyph_size
+					  * (this_to - this_from));
+	      if (! cache_in)
+		return -1;
+	      memcpy (cache_in, GREF (gstring, this_from),
+		      gstring->glyph_size * (this_to - this_from));
+	    }
+	}
+
+      if (cache_entry)
 	{
-	  /* Setup CTX.  */
+	  j = replay_flt_cache (cache_entry, gstring, this_from, this_to);
+	  MDEBUG_PRINT ("\n [FLT]   (CACHED)");
+	}
+      else
+	{
+	  int from_pos = GREF (gstring, this_from)->from;
+
+	  /* Setup CTX.  The output glyph string grows as necessary
+	     while running the stages.  */
 	  memset (&ctx, 0, sizeof ctx);
 	  ctx.match_indices = match_indices;
 	  ctx.font = font;
+	  ctx.run_font = run_font;
 	  ctx.cluster_begin_idx = -1;
 	  ctx.in = gstring;
 	  ctx.out = &out;
 	  j = run_stages (gstring, this_from, this_to, flt, &ctx);
-	  if (j != -2)
-	    break;
-	  out.allocated *= 2;
+	  if (j >= 0 && cache_hash)
+	    store_flt_cache (cache_hash, font, font_id, flt, cache_key,
+			     this_to - this_from, cache_in, gstring,
+			     this_from, j, from_pos);
 	}
 
       if (j < 0)
@@ -3093,10 +4910,9 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
     {
       int len = to - from;
 
-      GINIT (&out, len);
-      memcpy (((char *) out.glyphs),
-	      ((char *) gstring->glyphs) + gstring->glyph_size * from,
-	      gstring->glyph_size * len);
+      if (GINIT (&out, FLT_SCRATCH_OUT, to) < 0)
+	return -1;
+      GCPY (gstring, from, len, &out, from);
       for (i = from, j = to; i < to;)
 	{
 	  for (k = i + 1, j--; k < to && GREF (&out, k)->xadv == 0;
@@ -3109,6 +4925,69 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
   return to;
 }
 
+/*=*/
+
+/***en
+    @brief Layout characters of many runs with FLTs.
+
+    The mflt_run_batch () function layouts the $NRUNS runs of
+    characters in the array $RUNS in order.  For each run, it has the
+    same effect as calling mflt_run () with the members gstring, from,
+    to, font, and flt of the run, and stores the return value in the
+    member result of the run.  A failure of one run doesn't stop the
+    layout of the following runs.
+
+    The information about a font, i.e. the value of #mflt_font_id,
+    the FLTs configured for the font, and the OTF specs supported by
+    the font, is looked up only once for consecutive runs that have
+    the same font.  So it is more efficient to sort $RUNS by font.
+    The characters of each run are still encoded by the category
+    tables of the FLT, and the stages of the FLT are run for each run
+    separately.
+
+    @return
+    This function returns the number of runs that failed.  */
+
+/***ja
+    @brief ʣΥʸ FLT Ȥäƥ쥤Ȥ.
+
+    ؿ mflt_run_batch ()  $RUNS  $NRUNS ĤʸΥ
+    ˥쥤Ȥ롣ƥˤĤơΥ gstring, from,
+    to, font, flt Ȥ mflt_run () Ƥ֤ΤƱ̤
+    ֤ͤΥ result ˳Ǽ롣󤬼ԤƤ⡢
+    ³ΥΥ쥤Ȥ³롣
+
+    եȤ˴ؤ󡢤ʤ #mflt_font_id ͡ΥեȤ
+    Фꤵ줿 FLTӤΥեȤݡȤ OTF ϡ
+    ƱեȤϢ³ˤĤƤϰ٤Ĵ٤롣
+     $RUNS եȤǥȤƤΨŪǤ롣ƥ
+    ʸ FLT Υƥơ֥ˤä沽졢FLT Υơ
+    ϥ󤴤Ȥ̡˼¹Ԥ롣
+
+    @return
+    δؿϼԤο֤  */
+
+int
+mflt_run_batch (MFLTRun *runs, int nruns)
+{
+  FLTRunFont run_font;
+  int failed = 0;
+  int i;
+
+  for (i = 0; i < nruns; i++)
+    {
+      MFLTRun *run = runs + i;
+
+      if (i == 0 || run->font != run_font.font)
+	setup_run_font (&run_font, run->font);
+      run->result = run_flt (run->gstring, run->from, run->to, run->flt,
+			     &run_font);
+      if (run->result < 0)
+	failed++;
+    }
+  return failed;
+}
+
 /***en
     @brief Flag to control several new OTF handling commands.
 
@@ -3118,6 +4997,18 @@ mflt_run (MFLTGlyphString *gstring, int from, int to,
     category table.  */
 int mflt_enable_new_feature;
 
+/***en
+    @brief Number of layout results to cache.
+
+    If the variable mflt_run_cache_size is positive, the function
+    #mflt_run () remembers at most that many results of laying out a
+    run of characters, and reuses one when the same characters are
+    laid out again by the same FLT with the same font.  A font is
+    identified by #mflt_font_id and the members x_ppem and y_ppem of
+    #MFLTFont, so the cache is used only if #mflt_font_id is set.  The
+    default value is 0, which disables the cache.  */
+int mflt_run_cache_size;
+
 int (*mflt_iterate_otf_feature) (struct _MFLTFont *font,
 				 MFLTOtfSpec *spec,
 				 int from, int to,
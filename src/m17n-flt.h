@@ -425,11 +425,51 @@ extern MCharTable *mflt_coverage (MFLT *flt);
 extern int mflt_run (MFLTGlyphString *gstring, int from, int to,
 		     MFLTFont *font, MFLT *flt);
 
+/*=*/
+
+/***en
+    @brief Type of a run of characters to layout.
+
+    The type #MFLTRun is the structure that specifies a run of
+    characters given to mflt_run_batch ().  Runs that have the same
+    font share the information about the font, but each run still
+    encodes its characters by the category tables of the FLT.  */
+
+/***ja
+    @brief 쥤ȤʸΥη.
+
+     #MFLTRun  mflt_run_batch () ͿʸΥꤹ빽¤
+    ΤǤ롣ƱեȤĥϥեȤ˴ؤͭ뤬
+    ƥʸ FLT Υƥơ֥ˤäƤ줾沽롣  */
+
+typedef struct
+{
+  /***en Glyph string containing the characters.  */
+  /***ja ʸޤ॰  */
+  MFLTGlyphString *gstring;
+  /***en Range of the characters in #gstring.  */
+  /***ja #gstring ʸϰϡ  */
+  int from, to;
+  /***en Font to use.  */
+  /***ja Ѥեȡ  */
+  MFLTFont *font;
+  /***en FLT to use, or NULL to choose it automatically.  */
+  /***ja Ѥ FLTNULL ʤ鼫ưŪ֡  */
+  MFLT *flt;
+  /***en Set to the value mflt_run () would return.  */
+  /***ja mflt_run () ֤Ǥͤꤵ롣  */
+  int result;
+} MFLTRun;
+
+extern int mflt_run_batch (MFLTRun *runs, int nruns);
+
 /*=*/
 /*** @} */
 
 extern int mflt_enable_new_feature;
 
+extern int mflt_run_cache_size;
+
 extern MSymbol (*mflt_font_id) (MFLTFont *font);
 
 extern int (*mflt_iterate_otf_feature) (MFLTFont *font,
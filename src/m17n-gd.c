@@ -259,6 +259,154 @@ static void gd_render (MDrawWindow, int, int, MGlyphString *,
 static MFontDriver gd_font_driver =
   { NULL, gd_font_open, NULL, NULL, NULL, gd_render, NULL };
 
+/* Cache of rendered glyph bitmaps.  Realized fonts of this device
+   live until device_fini (), so a realized font pointer is a safe
+   key.  */
+
+typedef struct GlyphBitmap GlyphBitmap;
+
+struct GlyphBitmap
+{
+  /* Next bitmap in the same bucket of glyph_bitmap_table.  */
+  GlyphBitmap *next;
+  /* Neighbours in the list of bitmaps sorted by the recentness of
+     use.  */
+  GlyphBitmap *prev_used, *next_used;
+
+  MRealizedFont *rfont;
+  unsigned code;
+  int anti_alias;
+
+  /* Position of the top-left corner relative to the glyph origin, and
+     size in pixels.  */
+  int left, top, width, rows;
+
+  /* Coverage (0..255) of pixels, WIDTH * ROWS bytes.  A monochrome
+     bitmap has only 0 and 255.  */
+  unsigned char coverage[1];
+};
+
+#define GLYPH_BITMAP_BUCKETS 512
+
+/* Maximum number of bytes of coverage kept in the cache.  */
+#define GLYPH_BITMAP_CACHE_SIZE 0x200000
+
+static GlyphBitmap *glyph_bitmap_table[GLYPH_BITMAP_BUCKETS];
+
+/* The most recently and the least recently used bitmaps.  */
+static GlyphBitmap *glyph_bitmap_head, *glyph_bitmap_tail;
+
+static int glyph_bitmap_bytes;
+
+#define GLYPH_BITMAP_HASH(rfont, code, anti_alias)			\
+  (((((unsigned) (unsigned long) (rfont) >> 4) * 31 + (code)) * 2	\
+    + (anti_alias)) % GLYPH_BITMAP_BUCKETS)
+
+static void
+free_glyph_bitmap (GlyphBitmap *bitmap)
+{
+  GlyphBitmap **p = (glyph_bitmap_table
+		     + GLYPH_BITMAP_HASH (bitmap->rfont, bitmap->code,
+					  bitmap->anti_alias));
+
+  while (*p != bitmap)
+    p = &(*p)->next;
+  *p = bitmap->next;
+  if (bitmap->prev_used)
+    bitmap->prev_used->next_used = bitmap->next_used;
+  else
+    glyph_bitmap_head = bitmap->next_used;
+  if (bitmap->next_used)
+    bitmap->next_used->prev_used = bitmap->prev_used;
+  else
+    glyph_bitmap_tail = bitmap->prev_used;
+  glyph_bitmap_bytes -= bitmap->width * bitmap->rows;
+  free (bitmap);
+}
+
+/* Return the bitmap of glyph CODE of RFONT rendered with LOAD_FLAGS.
+   If it is not in the cache, render it by FreeType and cache it.
+   Return NULL on error.  */
+
+static GlyphBitmap *
+get_glyph_bitmap (MRealizedFont *rfont, unsigned code, int anti_alias,
+		  FT_Int32 load_flags)
+{
+  GlyphBitmap **bucket
+    = glyph_bitmap_table + GLYPH_BITMAP_HASH (rfont, code, anti_alias);
+  GlyphBitmap *bitmap;
+  FT_Face ft_face = rfont->fontp;
+  FT_Bitmap *ft_bitmap;
+  unsigned char *bmp, *cov;
+  int width, pitch;
+  int i, j;
+
+  for (bitmap = *bucket; bitmap; bitmap = bitmap->next)
+    if (bitmap->rfont == rfont && bitmap->code == code
+	&& bitmap->anti_alias == anti_alias)
+      {
+	if (bitmap->prev_used)
+	  {
+	    bitmap->prev_used->next_used = bitmap->next_used;
+	    if (bitmap->next_used)
+	      bitmap->next_used->prev_used = bitmap->prev_used;
+	    else
+	      glyph_bitmap_tail = bitmap->prev_used;
+	    bitmap->prev_used = NULL;
+	    bitmap->next_used = glyph_bitmap_head;
+	    glyph_bitmap_head->prev_used = bitmap;
+	    glyph_bitmap_head = bitmap;
+	  }
+	return bitmap;
+      }
+
+  if (FT_Load_Glyph (ft_face, (FT_UInt) code, load_flags))
+    return NULL;
+  ft_bitmap = &ft_face->glyph->bitmap;
+  width = ft_bitmap->width;
+  pitch = ft_bitmap->pitch;
+  if (! anti_alias)
+    pitch *= 8;
+  if (width > pitch)
+    width = pitch;
+  if (width < 0)
+    width = 0;
+  bitmap = malloc (sizeof (GlyphBitmap) + width * ft_bitmap->rows);
+  if (! bitmap)
+    return NULL;
+  bitmap->rfont = rfont;
+  bitmap->code = code;
+  bitmap->anti_alias = anti_alias;
+  bitmap->left = ft_face->glyph->bitmap_left;
+  bitmap->top = ft_face->glyph->bitmap_top;
+  bitmap->width = width;
+  bitmap->rows = ft_bitmap->rows;
+  for (i = 0, bmp = ft_bitmap->buffer, cov = bitmap->coverage;
+       i < bitmap->rows; i++, bmp += ft_bitmap->pitch, cov += width)
+    {
+      if (anti_alias)
+	memcpy (cov, bmp, width);
+      else
+	for (j = 0; j < width; j++)
+	  cov[j] = bmp[j / 8] & (1 << (7 - (j % 8))) ? 255 : 0;
+    }
+
+  bitmap->next = *bucket;
+  *bucket = bitmap;
+  bitmap->prev_used = NULL;
+  bitmap->next_used = glyph_bitmap_head;
+  if (glyph_bitmap_head)
+    glyph_bitmap_head->prev_used = bitmap;
+  else
+    glyph_bitmap_tail = bitmap;
+  glyph_bitmap_head = bitmap;
+  glyph_bitmap_bytes += width * bitmap->rows;
+  while (glyph_bitmap_bytes > GLYPH_BITMAP_CACHE_SIZE
+	 && glyph_bitmap_tail != bitmap)
+    free_glyph_bitmap (glyph_bitmap_tail);
+  return bitmap;
+}
+
 static MRealizedFont *
 gd_font_open (MFrame *frame, MFont *font, MFont *spec, MRealizedFont *rfont)
 {
@@ -287,6 +435,8 @@ gd_font_open (MFrame *frame, MFont *font, MFont *spec, MRealizedFont *rfont)
   if (! rfont)
     return NULL;
   M17N_OBJECT_REF (rfont->info);
+  if (rfont->metric_cache)
+    M17N_OBJECT_REF (rfont->metric_cache);
   MSTRUCT_CALLOC (new, MERROR_GD);
   *new = *rfont;
   new->driver = &gd_font_driver;
@@ -301,21 +451,25 @@ gd_render (MDrawWindow win, int x, int y,
 	   int reverse, MDrawRegion region)
 {
   gdImagePtr img = (gdImagePtr) win;
-  FT_Face ft_face;
   MRealizedFace *rface = from->rface;
   FT_Int32 load_flags = FT_LOAD_RENDER;
-  int i, j;
+  int i, j, k;
   int color, pixel;
   int r, g, b;
+  /* PIXELS[N] is the pixel value for coverage N, or -1 if not yet
+     resolved.  */
+  int pixels[256];
   
   if (from == to)
     return;
 
   /* It is assured that the all glyphs in the current range use the
      same realized face.  */
-  ft_face = rface->rfont->fontp;
   color = ((int *) rface->info)[reverse ? COLOR_INVERSE : COLOR_NORMAL];
   pixel = RESOLVE_COLOR (img, color);
+  for (i = 0; i < 255; i++)
+    pixels[i] = -1;
+  pixels[255] = pixel;
 
   if (gstring->anti_alias)
     r = color >> 16, g = (color >> 8) & 0xFF, b = color & 0xFF;
@@ -330,35 +484,28 @@ gd_render (MDrawWindow win, int x, int y,
 
   for (; from < to; x += from++->g.xadv)
     {
+      GlyphBitmap *bitmap;
       unsigned char *bmp;
       int xoff, yoff;
-      int width, pitch;
-
-      FT_Load_Glyph (ft_face, (FT_UInt) from->g.code, load_flags);
-      yoff = y - ft_face->glyph->bitmap_top + from->g.yoff;
-      bmp = ft_face->glyph->bitmap.buffer;
-      width = ft_face->glyph->bitmap.width;
-      pitch = ft_face->glyph->bitmap.pitch;
-      if (! gstring->anti_alias)
-	pitch *= 8;
-      if (width > pitch)
-	width = pitch;
+      int width;
+
+      bitmap = get_glyph_bitmap (rface->rfont, from->g.code,
+				 gstring->anti_alias, load_flags);
+      if (! bitmap)
+	continue;
+      yoff = y - bitmap->top + from->g.yoff;
+      bmp = bitmap->coverage;
+      width = bitmap->width;
 
+#if HAVE_GD == 1
       if (gstring->anti_alias)
-	for (i = 0; i < ft_face->glyph->bitmap.rows;
-	     i++, bmp += ft_face->glyph->bitmap.pitch, yoff++)
+	for (i = 0; i < bitmap->rows; i++, bmp += width, yoff++)
 	  {
-	    xoff = x + ft_face->glyph->bitmap_left + from->g.xoff;
+	    xoff = x + bitmap->left + from->g.xoff;
 	    for (j = 0; j < width; j++, xoff++)
 	      if (bmp[j] > 0)
 		{
 		  int pixel1 = pixel;
-#if HAVE_GD > 1
-		  int alpha = gdAlphaTransparent * (255 - bmp[j]) / 255;
-
-		  if (alpha > 0)
-		    pixel1 = gdImageColorResolveAlpha (img, r, g, b, alpha);
-#else
 		  int f = bmp[j] >> 5;
 
 		  if (f < 7)
@@ -374,18 +521,39 @@ gd_render (MDrawWindow win, int x, int y,
 				| ((b * f + b1 * (7 - f)) / 7));
 		      pixel1 = RESOLVE_COLOR (img, color1);
 		    }
-#endif
 		  gdImageSetPixel (img, xoff, yoff, pixel1);
 		}
 	  }
       else
-	for (i = 0; i < ft_face->glyph->bitmap.rows;
-	     i++, bmp += ft_face->glyph->bitmap.pitch, yoff++)
+#endif	/* HAVE_GD == 1 */
+	/* Draw each span of pixels of the same coverage at once.  */
+	for (i = 0; i < bitmap->rows; i++, bmp += width, yoff++)
 	  {
-	    xoff = x + ft_face->glyph->bitmap_left + from->g.xoff;
-	    for (j = 0; j < width; j++, xoff++)
-	      if (bmp[j / 8] & (1 << (7 - (j % 8))))
-		gdImageSetPixel (img, xoff, yoff, pixel);
+	    xoff = x + bitmap->left + from->g.xoff;
+	    for (j = 0; j < width; j = k)
+	      {
+		int cov = bmp[j];
+
+		for (k = j + 1; k < width && bmp[k] == cov; k++);
+		if (! cov)
+		  continue;
+#if HAVE_GD > 1
+		if (pixels[cov] < 0)
+		  {
+		    int alpha = gdAlphaTransparent * (255 - cov) / 255;
+
+		    pixels[cov] = (alpha > 0
+				   ? gdImageColorResolveAlpha (img, r, g, b,
+							       alpha)
+				   : pixel);
+		  }
+#endif
+		if (k - j > 1)
+		  gdImageLine (img, xoff + j, yoff, xoff + k - 1, yoff,
+			       pixels[cov]);
+		else
+		  gdImageSetPixel (img, xoff + j, yoff, pixels[cov]);
+	      }
 	  }
     }
 }
@@ -828,6 +996,9 @@ device_fini ()
   MPlist *plist;
   int i;
 
+  while (glyph_bitmap_head)
+    free_glyph_bitmap (glyph_bitmap_head);
+
   MPLIST_DO (plist, realized_fontset_list)
     mfont__free_realized_fontset ((MRealizedFontset *) MPLIST_VAL (plist));
   M17N_OBJECT_UNREF (realized_fontset_list);
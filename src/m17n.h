@@ -1050,7 +1050,8 @@ typedef struct MInputDriver
       @b Minput_status_done, @b Minput_candidates_start,
       @b Minput_candidates_draw, @b Minput_candidates_done,
       @b Minput_set_spot, @b Minput_toggle, @b Minput_reset,
-      @b Minput_get_surrounding_text, @b Minput_delete_surrounding_text.
+      @b Minput_get_surrounding_text, @b Minput_delete_surrounding_text,
+      @b Minput_preedit_update, @b Minput_get_surrounding_window.
       Values are functions of type #MInputCallbackFunc.  */
   /***ja
       @brief ХåؿΥꥹ.
@@ -1061,7 +1062,8 @@ typedef struct MInputDriver
       @b Minput_status_done, @b Minput_candidates_start,
       @b Minput_candidates_draw, @b Minput_candidates_done,
       @b Minput_set_spot, @b Minput_toggle, @b Minput_reset,
-      @b Minput_get_surrounding_text, @b Minput_delete_surrounding_text
+      @b Minput_get_surrounding_text, @b Minput_delete_surrounding_text,
+      @b Minput_preedit_update, @b Minput_get_surrounding_window
       ͤ#MInputCallbackFunc δؿ  */
   MPlist *callback_list;
 
@@ -1081,6 +1083,7 @@ extern MInputDriver *minput_driver;
 extern MSymbol Minput_preedit_start;
 extern MSymbol Minput_preedit_draw;
 extern MSymbol Minput_preedit_done;
+extern MSymbol Minput_preedit_update;
 extern MSymbol Minput_status_start;
 extern MSymbol Minput_status_draw;
 extern MSymbol Minput_status_done;
@@ -1091,6 +1094,7 @@ extern MSymbol Minput_set_spot;
 extern MSymbol Minput_toggle;
 extern MSymbol Minput_reset;
 extern MSymbol Minput_get_surrounding_text;
+extern MSymbol Minput_get_surrounding_window;
 extern MSymbol Minput_delete_surrounding_text;
 
 /** Symbols for special input key event.  */
@@ -1355,12 +1359,27 @@ extern int minput_filter (MInputContext *ic, MSymbol key, void *arg);
 
 extern int minput_lookup (MInputContext *ic, MSymbol key, void *arg,
 			  MText *mt);
+
+extern int minput_filter_batch (MInputContext *ic, MSymbol *keys, int nkeys,
+				MText *mt);
+
+extern int minput_async_begin (MInputContext *ic);
+
+extern int minput_async_complete (int token, MPlist *actions);
+
+extern int minput_async_fd (void);
+
+extern int minput_async_dispatch (void);
+
 extern void minput_set_spot (MInputContext *ic, int x, int y, int ascent,
 			     int descent, int fontsize, MText *mt, int pos);
 extern void minput_toggle (MInputContext *ic);
 
 extern void minput_reset_ic (MInputContext *ic);
 
+extern void minput_set_surrounding_revision (MInputContext *ic,
+					     int revision);
+
 extern MText *minput_get_description (MSymbol language, MSymbol name);
 
 extern MPlist *minput_get_title_icon (MSymbol language, MSymbol name);
@@ -860,6 +860,307 @@ mplist__from_string (unsigned char *str, int n)
   return plist;
 }
 
+/* Binary form of a plist.  It is used to cache data computed by the
+   library (e.g. the catalog of font files) by mdatabase__save_cache
+   ().  Each element is one of these:
+
+	'S' NAME '\0'			symbol (first occurrence)
+	'R' NUM				symbol (NUMth occurrence of 'S')
+	'I' NUM				integer
+	'T' NUM UTF-8-BYTES		M-text (NUM is the byte length)
+	'(' ELEMENT ... ')'		plist
+
+   NUM is an unsigned number in groups of 7 bits, the least
+   significant group first, where all bytes but the last have the 8th
+   bit set.  An integer N is written as NUM N * 2 if N >= 0, and
+   -N * 2 - 1 otherwise.  */
+
+/* Maximum depth of nested plists in the binary form.  */
+#define BINARY_MAX_DEPTH 256
+
+typedef struct
+{
+  MSymbol sym;
+  int idx;
+} MBinarySymbol;
+
+typedef struct
+{
+  FILE *fp;
+  /* Hash table of the symbols already written.  */
+  MBinarySymbol *table;
+  int size, used;
+} MBinaryWriter;
+
+#define BINARY_SYMBOL_HASH(sym, size)	\
+  ((((unsigned long) (sym)) >> 4) & ((size) - 1))
+
+/* Return the index of SYM in the symbols already written by WRITER.
+   If SYM is not yet written, register it and return -1.  */
+
+static int
+binary_symbol_index (MBinaryWriter *writer, MSymbol sym)
+{
+  MBinarySymbol *table = writer->table;
+  int i;
+
+  if (writer->used * 2 >= writer->size)
+    {
+      int size = writer->size ? writer->size * 2 : 256;
+      int j;
+
+      MTABLE_CALLOC (writer->table, size, MERROR_PLIST);
+      for (j = 0; j < writer->size; j++)
+	if (table[j].sym)
+	  {
+	    for (i = BINARY_SYMBOL_HASH (table[j].sym, size);
+		 writer->table[i].sym; i = (i + 1) & (size - 1));
+	    writer->table[i] = table[j];
+	  }
+      free (table);
+      table = writer->table;
+      writer->size = size;
+    }
+  for (i = BINARY_SYMBOL_HASH (sym, writer->size); table[i].sym;
+       i = (i + 1) & (writer->size - 1))
+    if (table[i].sym == sym)
+      return table[i].idx;
+  table[i].sym = sym;
+  table[i].idx = writer->used++;
+  return -1;
+}
+
+static void
+write_binary_num (unsigned n, FILE *fp)
+{
+  while (n >= 0x80)
+    {
+      putc ((n & 0x7F) | 0x80, fp);
+      n >>= 7;
+    }
+  putc (n, fp);
+}
+
+static int
+write_binary_element (MPlist *plist, MBinaryWriter *writer)
+{
+  FILE *fp = writer->fp;
+
+  if (MPLIST_SYMBOL_P (plist))
+    {
+      MSymbol sym = MPLIST_SYMBOL (plist);
+      int idx = binary_symbol_index (writer, sym);
+
+      if (idx >= 0)
+	{
+	  putc ('R', fp);
+	  write_binary_num (idx, fp);
+	}
+      else
+	{
+	  putc ('S', fp);
+	  fputs (msymbol_name (sym), fp);
+	  putc ('\0', fp);
+	}
+    }
+  else if (MPLIST_INTEGER_P (plist))
+    {
+      int n = MPLIST_INTEGER (plist);
+
+      putc ('I', fp);
+      write_binary_num (n >= 0 ? (unsigned) n * 2 : (~ (unsigned) n) * 2 + 1,
+			fp);
+    }
+  else if (MPLIST_MTEXT_P (plist))
+    {
+      MText *mt = MPLIST_MTEXT (plist);
+
+      if (mt->format > MTEXT_FORMAT_UTF_8 || mt->plist)
+	return -1;
+      putc ('T', fp);
+      write_binary_num (mt->nbytes, fp);
+      fwrite (mt->data, 1, mt->nbytes, fp);
+    }
+  else if (MPLIST_PLIST_P (plist))
+    {
+      MPlist *pl;
+
+      putc ('(', fp);
+      MPLIST_DO (pl, MPLIST_PLIST (plist))
+	if (write_binary_element (pl, writer) < 0)
+	  return -1;
+      putc (')', fp);
+    }
+  else
+    return -1;
+  return 0;
+}
+
+typedef struct
+{
+  unsigned char *p, *pend;
+  /* Set to 1 at the end of data, -1 on error.  */
+  int eof;
+  /* Symbols read so far.  */
+  MSymbol *symbols;
+  int nsymbols, symbols_size;
+} MBinaryReader;
+
+/* Read NUM from READER into *N.  Return 0 on success, -1 on
+   error.  */
+
+static int
+read_binary_num (MBinaryReader *reader, unsigned *n)
+{
+  int shift;
+
+  *n = 0;
+  for (shift = 0; reader->p < reader->pend && shift < 32; shift += 7)
+    {
+      int c = *reader->p++;
+
+      *n |= (unsigned) (c & 0x7F) << shift;
+      if (! (c & 0x80))
+	return 0;
+    }
+  return -1;
+}
+
+/* Read an element of the binary form from READER, and add it to
+   PLIST.  DEPTH is the depth of PLIST.  Return a list for the next
+   element, or NULL if there's no more element.  */
+
+static MPlist *
+read_binary_element (MPlist *plist, MBinaryReader *reader, int depth)
+{
+  unsigned char *p;
+  unsigned n;
+
+  if (reader->p == reader->pend)
+    {
+      reader->eof = 1;
+      return NULL;
+    }
+  switch (*reader->p++)
+    {
+    case 'S':
+      p = memchr (reader->p, '\0', reader->pend - reader->p);
+      if (! p)
+	break;
+      if (reader->nsymbols == reader->symbols_size)
+	{
+	  reader->symbols_size = (reader->symbols_size
+				  ? reader->symbols_size * 2 : 256);
+	  MTABLE_REALLOC (reader->symbols, reader->symbols_size,
+			  MERROR_PLIST);
+	}
+      reader->symbols[reader->nsymbols]
+	= msymbol__with_len ((char *) reader->p, p - reader->p);
+      MPLIST_SET_ADVANCE (plist, Msymbol,
+			  reader->symbols[reader->nsymbols++]);
+      reader->p = p + 1;
+      return plist;
+
+    case 'R':
+      if (read_binary_num (reader, &n) < 0 || n >= reader->nsymbols)
+	break;
+      MPLIST_SET_ADVANCE (plist, Msymbol, reader->symbols[n]);
+      return plist;
+
+    case 'I':
+      if (read_binary_num (reader, &n) < 0)
+	break;
+      MPLIST_SET_ADVANCE (plist, Minteger,
+			  (void *) (n & 1 ? ~ (int) (n >> 1) : (int) (n >> 1)));
+      return plist;
+
+    case 'T':
+      if (read_binary_num (reader, &n) < 0
+	  || n > reader->pend - reader->p)
+	break;
+      MPLIST_SET_ADVANCE (plist, Mtext,
+			  mtext__from_data (reader->p, n,
+					    MTEXT_FORMAT_UTF_8, 1));
+      reader->p += n;
+      return plist;
+
+    case '(':
+      {
+	MPlist *pl, *p;
+
+	if (depth >= BINARY_MAX_DEPTH)
+	  break;
+	MPLIST_NEW (pl);
+	p = pl;
+	while ((p = read_binary_element (p, reader, depth + 1)));
+	if (reader->eof)
+	  {
+	    /* Premature end of data or error.  */
+	    M17N_OBJECT_UNREF (pl);
+	    break;
+	  }
+	MPLIST_SET_ADVANCE (plist, Mplist, pl);
+	return plist;
+      }
+
+    case ')':
+      if (depth > 0)
+	return NULL;
+      break;
+    }
+  reader->eof = -1;
+  return NULL;
+}
+
+/* Write PLIST in the binary form to FP.  Return 0 on success, -1 if
+   PLIST contains an element that can't be written.  */
+
+int
+mplist__write_binary (MPlist *plist, FILE *fp)
+{
+  MBinaryWriter writer;
+  MPlist *pl;
+  int result = 0;
+
+  writer.fp = fp;
+  writer.table = NULL;
+  writer.size = writer.used = 0;
+  MPLIST_DO (pl, plist)
+    if (write_binary_element (pl, &writer) < 0)
+      {
+	result = -1;
+	break;
+      }
+  free (writer.table);
+  return result;
+}
+
+/* Make a plist from the binary form in STR of N bytes.  Return NULL
+   if STR is broken.  */
+
+MPlist *
+mplist__from_binary (unsigned char *str, int n)
+{
+  MPlist *plist, *pl;
+  MBinaryReader reader;
+
+  reader.p = str;
+  reader.pend = str + n;
+  reader.eof = 0;
+  reader.symbols = NULL;
+  reader.nsymbols = reader.symbols_size = 0;
+  MPLIST_NEW (plist);
+  pl = plist;
+  while ((pl = read_binary_element (pl, &reader, 0)));
+  free (reader.symbols);
+  if (reader.eof != 1)
+    {
+      M17N_OBJECT_UNREF (plist);
+      return NULL;
+    }
+  return plist;
+}
+
 int
 mplist__serialize (MText *mt, MPlist *plist, int pretty)
 {
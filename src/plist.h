@@ -109,6 +109,10 @@ extern MPlist *mplist__from_alist (MPlist *plist);
 
 extern MPlist *mplist__from_string (unsigned char *str, int n);
 
+extern int mplist__write_binary (MPlist *plist, FILE *fp);
+
+extern MPlist *mplist__from_binary (unsigned char *str, int n);
+
 extern int mplist__serialize (MText *mt, MPlist *plist, int pretty);
 
 extern MPlist *mplist__conc (MPlist *plist, MPlist *tail);